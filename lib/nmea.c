@@ -0,0 +1,318 @@
+/*
+ * Copyright 2018 Kurt Van Dijck <dev.kurt@vandijck-laurijssen.be>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "nmea.h"
+
+int nmea_check_sentence(char *line)
+{
+	char *str;
+	uint8_t nmea_sum, my_sum;
+
+	if ('$' != *line)
+		return NMEA_EBADSTART;
+
+	/* make my sum, start after initial $ */
+	for (str = line+1, my_sum = 0; *str; ++str) {
+		if (*str == '*') {
+			/* cut checksum field */
+			*str = 0;
+			/* end of sentence */
+			nmea_sum = strtoul(str+1, NULL, 16);
+			if (my_sum != nmea_sum)
+				return NMEA_EBADSUM;
+			return 0;
+		}
+		my_sum ^= *str;
+	}
+	/* no checksum found, that can't be good */
+	return NMEA_EINCOMPLETE;
+}
+
+const char *nmea_strerror(int err)
+{
+	switch (err) {
+	case 0:
+		return "ok";
+	case NMEA_EBADSTART:
+		return "bad nmea message";
+	case NMEA_EBADSUM:
+		return "bad sum on nmea msg";
+	case NMEA_EINCOMPLETE:
+		return "incomplete nmea msg";
+	default:
+		return "unknown nmea error";
+	}
+}
+
+int nmea_sprintf(char *buf, size_t size, const char *fmt, ...)
+{
+	va_list va;
+	int len, j;
+	uint8_t sum;
+
+	if (size < 7)
+		return -1;
+	buf[0] = '$';
+	va_start(va, fmt);
+	len = vsnprintf(buf+1, size-6, fmt, va);
+	va_end(va);
+	if (len < 0)
+		return len;
+	if (len > size-7)
+		len = size-7;
+	for (j = 0, sum = 0; j < len; ++j)
+		sum ^= buf[1+j];
+	return 1 + len + sprintf(buf+1+len, "*%02X\r\n", sum);
+}
+
+/* the last token had no trailing ',' */
+static int tok_last;
+
+char *nmea_tok(char *line)
+{
+	static char *saved_line;
+	char *str;
+
+	if (!line)
+		line = saved_line;
+	else if (*line == '$')
+		/* omit leading $ */
+		++line;
+
+	tok_last = 1;
+	for (str = line; *str; ++str) {
+		if (*str == ',') {
+			*str++ = 0;
+			tok_last = 0;
+			break;
+		}
+	}
+	saved_line = str;
+	return *line ? line : NULL;
+}
+
+char *nmea_field(void)
+{
+	if (tok_last)
+		return NULL;
+	return nmea_safe_tok(NULL);
+}
+
+double nmea_deg_to_double(const char *str)
+{
+	long lval;
+	char *endp;
+
+	if (!*str)
+		return NAN;
+	lval = strtol(str, &endp, 10);
+	return ((lval %100)+ strtod(endp, 0))/60.0 + (lval /100);
+}
+
+double nmea_tod(const char *str)
+{
+	long lval, frac = 0, div = 1;
+	char *endp;
+
+	if (!*str)
+		return NAN;
+	lval = strtol(str, &endp, 10);
+	lval = (lval / 10000)*3600 + (lval / 100 % 100)*60 + (lval % 100);
+	if (*endp != '.')
+		return lval;
+	/* fraction in integer arithmetic,
+	 * 1 division rounds exactly like strtod would
+	 */
+	for (++endp; *endp >= '0' && *endp <= '9' && div < 1000000000000000L; ++endp) {
+		frac = frac*10 + *endp - '0';
+		div *= 10;
+	}
+	return lval + (double)frac / div;
+}
+
+double nmea_strtod(const char *str)
+{
+	return *str ? strtod(str, NULL) : NAN;
+}
+
+void nmea_decode_gga_gns(const char *msg, struct nmea_gga *gga)
+{
+	int is_gga = !strcasecmp(msg+2, "GGA");
+
+	gga->tod = nmea_tod(nmea_safe_tok(NULL));
+	/* latt */
+	gga->lat = nmea_deg_to_double(nmea_safe_tok(NULL));
+	/* lat sign */
+	if (*nmea_safe_tok(NULL) == 'S')
+		gga->lat *= -1;
+	/* lon */
+	gga->lon = nmea_deg_to_double(nmea_safe_tok(NULL));
+	/* lon sign */
+	if (*nmea_safe_tok(NULL) == 'W')
+		gga->lon *= -1;
+	/* fix */
+	if (is_gga) {
+		gga->quality = strtoul(nmea_safe_tok(NULL), NULL, 10);
+		gga->modes = "";
+	} else {
+		gga->quality = -1;
+		gga->modes = nmea_safe_tok(NULL);
+	}
+	/* sats-in-use */
+	gga->satuse = strtoul(nmea_safe_tok(NULL), NULL, 10);
+	gga->hdop = nmea_strtod(nmea_safe_tok(NULL));
+	gga->alt = nmea_strtod(nmea_safe_tok(NULL));
+	if (is_gga)
+		/* M for meters */
+		nmea_tok(NULL);
+	/* geoidal seperation */
+	gga->geoid = nmea_strtod(nmea_safe_tok(NULL));
+	if (is_gga)
+		/* M for meters */
+		nmea_tok(NULL);
+	/* differential data */
+	gga->diffage = nmea_safe_tok(NULL);
+	gga->diffid = nmea_safe_tok(NULL);
+}
+
+void nmea_decode_gsa(struct nmea_gsa *gsa)
+{
+	int j, prn;
+
+	/* selection mode */
+	nmea_tok(NULL);
+	/* gps mode (no fix, 2D, 3D) */
+	gsa->mode = strtoul(nmea_safe_tok(NULL), NULL, 10);
+	/* 12 satellites */
+	for (j = gsa->nprn = 0; j < 12; ++j) {
+		prn = strtoul(nmea_safe_tok(NULL), NULL, 10);
+		if (prn)
+			gsa->prn[gsa->nprn++] = prn;
+	}
+	gsa->pdop = nmea_strtod(nmea_safe_tok(NULL));
+	gsa->hdop = nmea_strtod(nmea_safe_tok(NULL));
+	gsa->vdop = nmea_strtod(nmea_safe_tok(NULL));
+	gsa->sysid = strtoul(nmea_tok(NULL) ?: "1", NULL, 10);
+}
+
+void nmea_decode_gsv(struct nmea_gsv *gsv)
+{
+	const char *tok;
+	int j;
+
+	gsv->msgcnt = strtoul(nmea_safe_tok(NULL), NULL, 10);
+	gsv->msgidx = strtoul(nmea_safe_tok(NULL), NULL, 10);
+	gsv->nsat = strtoul(nmea_safe_tok(NULL), NULL, 10);
+
+	for (j = 0; j < 4; ++j) {
+		tok = nmea_safe_tok(NULL);
+		if (!*tok)
+			break;
+		gsv->sv[j].prn = strtoul(tok, NULL, 10);
+		gsv->sv[j].elv = strtoul(nmea_safe_tok(NULL), NULL, 10);
+		gsv->sv[j].azm = strtoul(nmea_safe_tok(NULL), NULL, 10);
+		gsv->sv[j].snr = strtoul(nmea_tok(NULL) ?: "-1", NULL, 10);
+	}
+	gsv->nsv = j;
+}
+
+void nmea_decode_vtg(struct nmea_vtg *vtg)
+{
+	int j;
+
+	/* true heading */
+	vtg->heading = nmea_strtod(nmea_safe_tok(NULL));
+	nmea_tok(NULL);
+	/* magnetic heading */
+	vtg->magnetic = nmea_strtod(nmea_safe_tok(NULL));
+	/* skip 'M', speed in knots, 'N' */
+	for (j = 4; j < 7; ++j)
+		nmea_tok(NULL);
+	vtg->speed = nmea_strtod(nmea_safe_tok(NULL));
+}
+
+void nmea_decode_rmc(struct nmea_rmc *rmc)
+{
+	const char *tok;
+	int date;
+
+	rmc->tod = nmea_tod(nmea_safe_tok(NULL));
+	rmc->status = *nmea_safe_tok(NULL);
+	rmc->lat = nmea_deg_to_double(nmea_safe_tok(NULL));
+	if (*nmea_safe_tok(NULL) == 'S')
+		rmc->lat *= -1;
+	rmc->lon = nmea_deg_to_double(nmea_safe_tok(NULL));
+	if (*nmea_safe_tok(NULL) == 'W')
+		rmc->lon *= -1;
+	/* knots */
+	rmc->speed = nmea_strtod(nmea_safe_tok(NULL)) * 1.852;
+	rmc->heading = nmea_strtod(nmea_safe_tok(NULL));
+	/* ddmmyy */
+	tok = nmea_safe_tok(NULL);
+	date = strtoul(tok, NULL, 10);
+	if (*tok) {
+		rmc->mday = date / 10000;
+		rmc->mon = date / 100 % 100;
+		rmc->year = date % 100;
+		rmc->year += (rmc->year < 80) ? 2000 : 1900;
+	} else
+		rmc->mday = rmc->mon = rmc->year = 0;
+	/* magnetic variation & direction */
+	nmea_tok(NULL);
+	nmea_tok(NULL);
+	rmc->mode = *nmea_safe_tok(NULL);
+}
+
+void nmea_decode_gll(struct nmea_gll *gll)
+{
+	gll->lat = nmea_deg_to_double(nmea_safe_tok(NULL));
+	if (*nmea_safe_tok(NULL) == 'S')
+		gll->lat *= -1;
+	gll->lon = nmea_deg_to_double(nmea_safe_tok(NULL));
+	if (*nmea_safe_tok(NULL) == 'W')
+		gll->lon *= -1;
+	gll->tod = nmea_tod(nmea_safe_tok(NULL));
+	gll->status = *nmea_safe_tok(NULL);
+	gll->mode = *nmea_safe_tok(NULL);
+}
+
+void nmea_decode_gst(struct nmea_gst *gst)
+{
+	gst->tod = nmea_tod(nmea_safe_tok(NULL));
+	gst->rms = nmea_strtod(nmea_safe_tok(NULL));
+	gst->smajor = nmea_strtod(nmea_safe_tok(NULL));
+	gst->sminor = nmea_strtod(nmea_safe_tok(NULL));
+	gst->orient = nmea_strtod(nmea_safe_tok(NULL));
+	gst->lat = nmea_strtod(nmea_safe_tok(NULL));
+	gst->lon = nmea_strtod(nmea_safe_tok(NULL));
+	gst->alt = nmea_strtod(nmea_safe_tok(NULL));
+}
+
+void nmea_decode_zda(struct nmea_zda *zda)
+{
+	zda->tod = nmea_tod(nmea_safe_tok(NULL));
+	zda->mday = strtoul(nmea_safe_tok(NULL), NULL, 10);
+	zda->mon = strtoul(nmea_safe_tok(NULL), NULL, 10);
+	zda->year = strtoul(nmea_safe_tok(NULL), NULL, 10);
+}
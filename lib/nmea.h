@@ -0,0 +1,146 @@
+#ifndef _nmea_h_
+#define _nmea_h_
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* NMEA0183 sentence decoding, shared by the programs */
+
+/* nmea_check_sentence() error codes */
+#define NMEA_EBADSTART	-1
+#define NMEA_EBADSUM	-2
+#define NMEA_EINCOMPLETE	-3
+
+/* validate checksum, and cut it from <line>
+ * return 0 on success, or negative error code
+ */
+extern int nmea_check_sentence(char *line);
+extern const char *nmea_strerror(int err);
+
+/* strtok-alike tokenizer, that does not collapse empty fields,
+ * a leading '$' is omitted.
+ * returns NULL for empty fields
+ */
+extern char *nmea_tok(char *line);
+static inline char *nmea_safe_tok(char *line)
+{
+	return nmea_tok(line) ?: "";
+}
+/* the next field after nmea_tok(),
+ * returns "" for empty fields, and NULL past the last field
+ */
+extern char *nmea_field(void);
+
+/* parse DDDMM.MMMMM to double */
+extern double nmea_deg_to_double(const char *str);
+/* parse hhmmss.ss to seconds within day */
+extern double nmea_tod(const char *str);
+extern double nmea_strtod(const char *str);
+
+/* format a sentence, without leading '$' and trailing '*XX\r\n'
+ * this adds both, and returns the length like snprintf
+ */
+__attribute__((format(printf,3,4)))
+extern int nmea_sprintf(char *buf, size_t size, const char *fmt, ...);
+
+/* sentence decoders
+ * call these after nmea_tok(line) returned the sentence id
+ * undefined floating point values are NAN
+ */
+struct nmea_gga {
+	double tod;
+	double lat, lon;
+	/* GGA fix quality, -1 for GNS */
+	int quality;
+	/* GNS mode indicator characters */
+	const char *modes;
+	int satuse;
+	double hdop;
+	double alt;
+	double geoid;
+	const char *diffage;
+	const char *diffid;
+};
+/* decode GGA or GNS, depending on <msg> */
+extern void nmea_decode_gga_gns(const char *msg, struct nmea_gga *);
+
+struct nmea_gsa {
+	/* 1: no fix, 2: 2D, 3: 3D */
+	int mode;
+	int nprn;
+	int prn[12];
+	double pdop, hdop, vdop;
+	/* system id, NMEA 4.10 */
+	int sysid;
+};
+extern void nmea_decode_gsa(struct nmea_gsa *);
+
+struct nmea_gsv {
+	int msgcnt, msgidx;
+	/* sats in view */
+	int nsat;
+	/* sats in this message */
+	int nsv;
+	struct {
+		int prn;
+		int elv, azm;
+		/* -1 when not tracked */
+		int snr;
+	} sv[4];
+};
+extern void nmea_decode_gsv(struct nmea_gsv *);
+
+struct nmea_vtg {
+	double heading;
+	double magnetic;
+	/* km/h */
+	double speed;
+};
+extern void nmea_decode_vtg(struct nmea_vtg *);
+
+struct nmea_zda {
+	double tod;
+	int mday, mon, year;
+};
+extern void nmea_decode_zda(struct nmea_zda *);
+
+struct nmea_rmc {
+	double tod;
+	/* 'A' valid, 'V' warning */
+	char status;
+	double lat, lon;
+	/* km/h */
+	double speed;
+	double heading;
+	/* 0 without date */
+	int mday, mon, year;
+	/* mode indicator, NMEA 2.3, 0 if absent */
+	char mode;
+};
+extern void nmea_decode_rmc(struct nmea_rmc *);
+
+struct nmea_gll {
+	double lat, lon;
+	double tod;
+	char status;
+	char mode;
+};
+extern void nmea_decode_gll(struct nmea_gll *);
+
+/* pseudorange noise statistics, in meters */
+struct nmea_gst {
+	double tod;
+	double rms;
+	double smajor, sminor, orient;
+	/* 1 sigma errors */
+	double lat, lon, alt;
+};
+extern void nmea_decode_gst(struct nmea_gst *);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,84 @@
+/*
+ * Copyright 2018 Kurt Van Dijck <dev.kurt@vandijck-laurijssen.be>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "nmeashm.h"
+
+struct nmeashm *nmeashm_create(const char *name)
+{
+	int fd;
+	struct nmeashm *shm;
+
+	fd = shm_open(name, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+		return NULL;
+	if (ftruncate(fd, sizeof(*shm)) < 0) {
+		close(fd);
+		return NULL;
+	}
+	shm = mmap(NULL, sizeof(*shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED)
+		return NULL;
+	/* a restarted writer reuses the segment, keep seq going */
+	shm->magic = NMEASHM_MAGIC;
+	shm->version = NMEASHM_VERSION;
+	shm->size = sizeof(*shm);
+	if (shm->seq & 1)
+		++shm->seq;
+	return shm;
+}
+
+const struct nmeashm *nmeashm_open(const char *name)
+{
+	int fd;
+	struct stat st;
+	const struct nmeashm *shm;
+
+	fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0) {
+		close(fd);
+		return NULL;
+	}
+	if (st.st_size < sizeof(*shm)) {
+		close(fd);
+		errno = EPROTO;
+		return NULL;
+	}
+	shm = mmap(NULL, sizeof(*shm), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (shm == MAP_FAILED)
+		return NULL;
+	if (shm->magic != NMEASHM_MAGIC || shm->version != NMEASHM_VERSION ||
+			shm->size != sizeof(*shm)) {
+		munmap((void *)shm, sizeof(*shm));
+		errno = EPROTO;
+		return NULL;
+	}
+	return shm;
+}
+
+void nmeashm_close(const struct nmeashm *shm)
+{
+	munmap((void *)shm, sizeof(*shm));
+}
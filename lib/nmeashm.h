@@ -0,0 +1,97 @@
+#ifndef _nmeashm_h_
+#define _nmeashm_h_
+
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* latest fix in POSIX shared memory, for co-located readers
+ *
+ * nmea0183tomqtt is the only writer, it updates the segment
+ * after each decoded sentence under a seqlock.
+ * Readers take a lock-free snapshot with nmeashm_read().
+ */
+#define NMEASHM_MAGIC	0x4e4d4541 /* "NMEA" */
+#define NMEASHM_VERSION	1
+#define NMEASHM_MAXSATS	128
+
+struct nmeashm_sat {
+	int16_t prn;
+	int16_t elv;
+	int16_t azm;
+	/* -1 when not tracked */
+	int16_t snr;
+};
+
+struct nmeashm_fix {
+	/* writer is running */
+	int32_t alive;
+	int32_t quality;
+	/* increments with each update */
+	uint64_t nupdates;
+	/* CLOCK_MONOTONIC of the update, in nsec */
+	int64_t updated;
+	/* seconds since midnight, UTC */
+	double tod;
+	/* seconds since 1970, NAN without date */
+	double utc;
+	/* degrees, meters, km/h */
+	double lat, lon, alt;
+	double speed, heading;
+	double hdop;
+	int32_t satuse;
+	int32_t nsats;
+	struct nmeashm_sat sats[NMEASHM_MAXSATS];
+};
+
+struct nmeashm {
+	uint32_t magic;
+	uint32_t version;
+	/* size of the struct, to detect layout changes */
+	uint32_t size;
+	/* odd while writing */
+	uint32_t seq;
+	struct nmeashm_fix fix;
+};
+
+/* writer */
+static inline void nmeashm_write(struct nmeashm *shm, const struct nmeashm_fix *fix)
+{
+	uint32_t seq = __atomic_load_n(&shm->seq, __ATOMIC_RELAXED);
+
+	__atomic_store_n(&shm->seq, seq+1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(&shm->fix, fix, sizeof(*fix));
+	__atomic_store_n(&shm->seq, seq+2, __ATOMIC_RELEASE);
+}
+
+/* take a coherent snapshot, spin while the writer is busy */
+static inline void nmeashm_read(const struct nmeashm *shm, struct nmeashm_fix *fix)
+{
+	uint32_t seq;
+
+	for (;;) {
+		seq = __atomic_load_n(&shm->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+		memcpy(fix, &shm->fix, sizeof(*fix));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&shm->seq, __ATOMIC_RELAXED) == seq)
+			return;
+	}
+}
+
+/* create (writer) or open (reader, read-only) segment <name>
+ * return NULL with errno set on failure
+ */
+extern struct nmeashm *nmeashm_create(const char *name);
+extern const struct nmeashm *nmeashm_open(const char *name);
+extern void nmeashm_close(const struct nmeashm *shm);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,289 @@
+/*
+ * Copyright 2018 Kurt Van Dijck <dev.kurt@vandijck-laurijssen.be>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* microbenchmarks for the nmea0183tomqtt hot paths
+ * nmea0183tomqtt.c is included, so its static functions are reachable.
+ * heap allocations are counted with ld's --wrap
+ */
+#define main nmea0183tomqtt_main
+#include "nmea0183tomqtt.c"
+#undef main
+
+/* allocation counting */
+static unsigned long nallocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+char *__real_strdup(const char *str);
+int __real_vasprintf(char **pstr, const char *fmt, va_list va);
+
+void *__wrap_malloc(size_t size)
+{
+	++nallocs;
+	return __real_malloc(size);
+}
+void *__wrap_calloc(size_t n, size_t size)
+{
+	++nallocs;
+	return __real_calloc(n, size);
+}
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	++nallocs;
+	return __real_realloc(ptr, size);
+}
+char *__wrap_strdup(const char *str)
+{
+	++nallocs;
+	return __real_strdup(str);
+}
+int __wrap_vasprintf(char **pstr, const char *fmt, va_list va)
+{
+	++nallocs;
+	return __real_vasprintf(pstr, fmt, va);
+}
+
+/* generated traffic */
+#define NLINES	4096
+static char *lines[NLINES];
+static int lens[NLINES];
+static int nlines;
+
+static void add_line(const char *str, int len)
+{
+	if (nlines >= NLINES)
+		return;
+	lines[nlines] = strdup(str);
+	lens[nlines++] = len;
+}
+
+/* multi-constellation epochs: GGA, GNS, VTG, ZDA, GSA & GSV for 4 talkers */
+static void gen_traffic(void)
+{
+	static const char *const talkers[] = { "GP", "GL", "GA", "GB", };
+	static const int prnbase[] = { 1, 65, 301, 201, };
+	char line[256], *str;
+	int epoch, t, j, k, msgcnt, len;
+	double lat, lon;
+
+	srand(1);
+	for (epoch = 0; nlines < NLINES - 32; ++epoch) {
+		int hh = 12 + epoch / 3600, mm = epoch / 60 % 60, ss = epoch % 60;
+
+		lat = 5100 + epoch * 0.00031;
+		lon = 443 + epoch * 0.00017;
+		len = nmea_sprintf(line, sizeof(line), "GPGGA,%02i%02i%02i.00,%010.5f,N,%011.5f,E,1,%i,%.2f,%.1f,M,47.3,M,,",
+				hh, mm, ss, lat, lon, 14 + rand() % 4, 0.8 + (rand() % 10) / 10.0, 31.0 + (rand() % 20) / 10.0);
+		add_line(line, len);
+		len = nmea_sprintf(line, sizeof(line), "GNGNS,%02i%02i%02i.00,%010.5f,N,%011.5f,E,AAAA,%i,%.2f,%.1f,47.3,,",
+				hh, mm, ss, lat, lon, 28 + rand() % 4, 0.6 + (rand() % 10) / 10.0, 31.0 + (rand() % 20) / 10.0);
+		add_line(line, len);
+		len = nmea_sprintf(line, sizeof(line), "GPVTG,%.2f,T,,M,%.3f,N,%.3f,K,A",
+				(rand() % 36000) / 100.0, (rand() % 1000) / 100.0, (rand() % 1800) / 100.0);
+		add_line(line, len);
+		len = nmea_sprintf(line, sizeof(line), "GPZDA,%02i%02i%02i.00,18,10,2026,00,00", hh, mm, ss);
+		add_line(line, len);
+		for (t = 0; t < 4; ++t) {
+			str = line + sprintf(line, "%sGSA,A,3", talkers[t]);
+			for (j = 0; j < 12; ++j)
+				str += (j < 8) ? sprintf(str, ",%02i", prnbase[t]+j) : sprintf(str, ",");
+			sprintf(str, ",1.5,0.9,1.2,%i", t+1);
+			/* re-format for the checksum */
+			str = strdup(line);
+			len = nmea_sprintf(line, sizeof(line), "%s", str);
+			free(str);
+			add_line(line, len);
+
+			/* 12 sats per constellation */
+			msgcnt = 3;
+			for (j = 1; j <= msgcnt; ++j) {
+				str = line + sprintf(line, "%sGSV,%i,%i,12", talkers[t], msgcnt, j);
+				for (k = 0; k < 4; ++k)
+					str += sprintf(str, ",%i,%i,%i,%i", prnbase[t] + (j-1)*4 + k,
+							10 + k*15, (epoch + k*90) % 360, 20 + rand() % 30);
+				str = strdup(line);
+				len = nmea_sprintf(line, sizeof(line), "%s", str);
+				free(str);
+				add_line(line, len);
+			}
+		}
+	}
+}
+
+/* benchmark core */
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static char scratch[1024];
+
+/* prepare a line: copy, validate & consume the sentence id */
+static const char *prepare(int idx)
+{
+	char *tok;
+
+	memcpy(scratch, lines[idx], lens[idx]+1);
+	/* cut \r\n */
+	scratch[lens[idx]-2] = 0;
+	if (nmea_check_sentence(scratch) < 0)
+		return NULL;
+	tok = nmea_tok(scratch);
+	talker[0] = tolower(tok[0]);
+	talker[1] = tolower(tok[1]);
+	return tok;
+}
+
+typedef void (*benchfn)(int idx, const char *tok);
+
+/* run <fn> over all generated lines that match <filter>,
+ * return ns/call and allocs/call
+ */
+static double run(benchfn fn, const char *filter, double *allocs)
+{
+	int j, n;
+	long loops, calls;
+	double t0, t;
+	unsigned long a0;
+
+	t0 = now();
+	a0 = nallocs;
+	for (loops = calls = 0; loops < 10 || now() - t0 < 0.3; ++loops) {
+		for (j = n = 0; j < nlines; ++j) {
+			if (filter && strncmp(lines[j]+3, filter, 3))
+				continue;
+			fn(j, prepare(j));
+			++n;
+		}
+		calls += n;
+	}
+	t = now() - t0;
+	*allocs = calls ? (double)(nallocs - a0) / calls : 0;
+	return calls ? t * 1e9 / calls : 0;
+}
+
+static void report(const char *name, benchfn fn, benchfn base, const char *filter)
+{
+	double ns, ns0, allocs, allocs0;
+
+	ns = run(fn, filter, &allocs);
+	ns0 = base ? run(base, filter, &allocs0) : 0;
+	if (!base)
+		allocs0 = 0;
+	printf("%-24s %9.1f ns/sentence %6.2f allocs/sentence\n", name, ns - ns0, allocs - allocs0);
+}
+
+/* the benchmarked code, on top of prepare() */
+static void b_prepare(int idx, const char *tok)
+{
+}
+
+static void b_flush(int idx, const char *tok)
+{
+	flush_pending_topics();
+}
+
+static void b_valid(int idx, const char *tok)
+{
+	/* prepare() already validated, do it again */
+	memcpy(scratch, lines[idx], lens[idx]+1);
+	scratch[lens[idx]-2] = 0;
+	nmea_is_valid_sentence(scratch);
+}
+static void b_copy(int idx, const char *tok)
+{
+	memcpy(scratch, lines[idx], lens[idx]+1);
+	scratch[lens[idx]-2] = 0;
+}
+
+static void b_tok(int idx, const char *tok)
+{
+	while (nmea_tok(NULL))
+		;
+}
+
+static void b_gga_gns(int idx, const char *tok)
+{
+	recvd_gga_gns(tok);
+	flush_pending_topics();
+}
+
+static void b_gsv(int idx, const char *tok)
+{
+	recvd_gsv();
+	flush_pending_topics();
+}
+
+static const char *const cachetopics[] = {
+	"gps/lat", "gps/lon", "gps/alt", "gps/quality", "gps/hdop", "gps/geoid",
+	"gps/diff/age", "gps/diff/id", "gps/gp/satuse", "gps/gn/satuse",
+	"gps/heading", "gps/heading/magnetic", "gps/speed", "gps/utc", "gps/datetime",
+	"gps/mode", "gps/pdop", "gps/vdop", "gps/gl/mode", "gps/ga/mode",
+	NULL,
+};
+
+static void b_publish_cache(int idx, const char *tok)
+{
+	const char *const *topic;
+	char value[16];
+
+	sprintf(value, "%i", idx & 7);
+	for (topic = cachetopics; *topic; ++topic)
+		publish_cache(*topic, value, FL_RETAIN);
+}
+
+static void b_publish_flush(int idx, const char *tok)
+{
+	b_publish_cache(idx, tok);
+	flush_pending_topics();
+}
+
+static void b_recvd_data(int idx, const char *tok)
+{
+	recvd_data(lines[idx], lens[idx]);
+}
+
+int main(int argc, char *argv[])
+{
+	static char msgs[] = "gga,gns,gsa,gsv,vtg,zda";
+
+	/* keep the benchmark silent, and publish into the void */
+	logtostderr = 0;
+	setlogmask(LOG_UPTO(LOG_ERR));
+	outfile = fopen("/dev/null", "w");
+	if (!outfile)
+		mylog(LOG_ERR | LOG_EXIT, "fopen /dev/null: %s", ESTR(errno));
+	merge_nmea_use(msgs);
+
+	gen_traffic();
+	printf("%i generated sentences\n", nlines);
+
+	report("nmea_is_valid_sentence", b_valid, b_copy, NULL);
+	report("nmea_tok", b_tok, b_prepare, NULL);
+	report("recvd_gga_gns (GGA)", b_gga_gns, b_flush, "GGA");
+	report("recvd_gga_gns (GNS)", b_gga_gns, b_flush, "GNS");
+	report("recvd_gsv", b_gsv, b_flush, "GSV");
+	/* publish_cache for 20 topics */
+	report("publish_cache (x20)", b_publish_cache, b_prepare, NULL);
+	report("flush_pending_topics", b_publish_flush, b_publish_cache, NULL);
+	report("recvd_data", b_recvd_data, b_prepare, NULL);
+	return 0;
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright 2018 Kurt Van Dijck <dev.kurt@vandijck-laurijssen.be>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* fuzz entry point: feed arbitrary bytes into recvd_data()
+ * Build with clang -fsanitize=fuzzer for libFuzzer,
+ * or without it for AFL & plain replay: input files are then
+ * read from the arguments, or stdin
+ */
+#define main nmea0183tomqtt_main
+#include "nmea0183tomqtt.c"
+#undef main
+
+int LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+	static char msgs[] = "gga,gns,gsa,gsv,vtg,zda,rmc,gll,gst";
+
+	logtostderr = 0;
+	setlogmask(LOG_UPTO(LOG_ERR));
+	outfile = fopen("/dev/null", "w");
+	if (!outfile)
+		mylog(LOG_ERR | LOG_EXIT, "fopen /dev/null: %s", ESTR(errno));
+	merge_nmea_use(msgs);
+	track_tol = 1;
+	derive_ecef = derive_utm = have_origin = 1;
+	origin_init();
+	return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	size_t pos, n;
+
+	/* use the same chunks as the read() loop */
+	for (pos = 0; pos < size; pos += n) {
+		n = size - pos;
+		if (n > 1024)
+			n = 1024;
+		recvd_data((const char *)data+pos, n);
+	}
+	return 0;
+}
+
+#ifndef FUZZ_LIBFUZZER
+static void fuzz_fd(int fd)
+{
+	static uint8_t dat[1 << 20];
+	size_t len;
+	ssize_t ret;
+
+	for (len = 0; len < sizeof(dat); len += ret) {
+		ret = read(fd, dat+len, sizeof(dat)-len);
+		if (ret < 0)
+			mylog(LOG_ERR | LOG_EXIT, "read: %s", ESTR(errno));
+		if (!ret)
+			break;
+	}
+	LLVMFuzzerTestOneInput(dat, len);
+}
+
+int main(int argc, char *argv[])
+{
+	int j, fd;
+
+	LLVMFuzzerInitialize(&argc, &argv);
+	if (argc < 2) {
+		fuzz_fd(STDIN_FILENO);
+		return 0;
+	}
+	for (j = 1; j < argc; ++j) {
+		fd = open(argv[j], O_RDONLY);
+		if (fd < 0)
+			mylog(LOG_ERR | LOG_EXIT, "open %s: %s", argv[j], ESTR(errno));
+		fuzz_fd(fd);
+		close(fd);
+	}
+	return 0;
+}
+#endif
@@ -0,0 +1,679 @@
+/*
+ * Copyright 2018 Kurt Van Dijck <dev.kurt@vandijck-laurijssen.be>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <syslog.h>
+#include <termios.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "lib/nmea.h"
+
+#define NAME "nmea-gen"
+#ifndef VERSION
+#define VERSION "<undefined version>"
+#endif
+
+/* generic error logging */
+#define LOG_EXIT	0x4000000
+
+/* safeguard our LOG_EXIT extension */
+#if (LOG_EXIT & (LOG_FACMASK | LOG_PRIMASK))
+#error LOG_EXIT conflict
+#endif
+
+static int loglevel = LOG_WARNING;
+
+void mylog(int level, const char *fmt, ...)
+{
+	va_list va;
+	char *msg = NULL;
+
+	if ((level & LOG_PRIMASK) <= loglevel) {
+		va_start(va, fmt);
+		vasprintf(&msg, fmt, va);
+		va_end(va);
+
+		struct iovec vec[] = {
+			{ .iov_base = NAME, .iov_len = strlen(NAME), },
+			{ .iov_base = ": ", .iov_len = 2, },
+			{ .iov_base = msg, .iov_len = strlen(msg), },
+			{ .iov_base = "\n", .iov_len = 1, },
+		};
+		writev(STDERR_FILENO, vec, sizeof(vec)/sizeof(vec[0]));
+		free(msg);
+	}
+	if (level & LOG_EXIT)
+		exit(1);
+}
+
+#define ESTR(num)	strerror(num)
+
+/* program options */
+static const char help_msg[] =
+	NAME ": Generate synthetic GNSS receiver output\n"
+	"usage:	" NAME " [OPTIONS ...]\n"
+	"\n"
+	"Options\n"
+	" -V, --version		Show version\n"
+	" -v, --verbose		Be more verbose\n"
+	" -c, --constellations=TK[:N][,TK[:N]...]\n"
+	"			Constellations & #satellites, TK is GP, GL, GA, GB or GQ\n"
+	"			Default: GP:12,GL:8\n"
+	" -r, --rate=HZ		Epochs per second, 1..50 (default 1)\n"
+	" -n, --nmea=GGA[,GSV...]	Sentence mix, possible are\n"
+	"			GGA, GNS, GSA, GSV, VTG, ZDA, RMC, GLL, GST, TXT & UBX\n"
+	"			Default: GGA,GSA,GSV,VTG,ZDA\n"
+	" -P, --position=LAT,LON	Start position (default 51.0,4.4)\n"
+	" -S, --speed=M/S	Speed (default 10)\n"
+	" -T, --turn=DEG/S	Turn rate, to drive in circles (default 1)\n"
+	" -e, --errors=PROB	Corrupt sentences with probability PROB (0..1)\n"
+	" -g, --garbage=PROB	Insert random garbage with probability PROB per sentence\n"
+	" -N, --epochs=N	Stop after N epochs (default: run forever)\n"
+	" -f, --flat-out		Don't pace the output in real time\n"
+	" -o, --output=FILE	Write to FILE (default stdout)\n"
+	" -t, --pty[=LINK]	Write to a new pseudo terminal, optionally symlinked to LINK\n"
+	"			Use the pty as DEVICE for nmea0183tomqtt\n"
+	" -s, --seed=N		Random seed\n"
+	" -u, --udp=HOST:PORT	Send each epoch as 1 datagram to HOST:PORT\n"
+	" -F, --fleet=N		Send from N UDP sockets, to act as N trackers (default 1)\n"
+	;
+
+#ifdef _GNU_SOURCE
+static struct option long_opts[] = {
+	{ "help", no_argument, NULL, '?', },
+	{ "version", no_argument, NULL, 'V', },
+	{ "verbose", no_argument, NULL, 'v', },
+
+	{ "constellations", required_argument, NULL, 'c', },
+	{ "rate", required_argument, NULL, 'r', },
+	{ "nmea", required_argument, NULL, 'n', },
+	{ "position", required_argument, NULL, 'P', },
+	{ "speed", required_argument, NULL, 'S', },
+	{ "turn", required_argument, NULL, 'T', },
+	{ "errors", required_argument, NULL, 'e', },
+	{ "garbage", required_argument, NULL, 'g', },
+	{ "epochs", required_argument, NULL, 'N', },
+	{ "flat-out", no_argument, NULL, 'f', },
+	{ "output", required_argument, NULL, 'o', },
+	{ "pty", optional_argument, NULL, 't', },
+	{ "seed", required_argument, NULL, 's', },
+	{ "udp", required_argument, NULL, 'u', },
+	{ "fleet", required_argument, NULL, 'F', },
+
+	{ },
+};
+#else
+#define getopt_long(argc, argv, optstring, longopts, longindex) \
+	getopt((argc), (argv), (optstring))
+#endif
+static const char optstring[] = "Vv?c:r:n:P:S:T:e:g:N:fo:t::s:u:F:";
+
+/* sentence mix */
+#define NM_GGA	(1 << 0)
+#define NM_GNS	(1 << 1)
+#define NM_GSA	(1 << 2)
+#define NM_GSV	(1 << 3)
+#define NM_VTG	(1 << 4)
+#define NM_ZDA	(1 << 5)
+#define NM_TXT	(1 << 6)
+#define NM_UBX	(1 << 7)
+#define NM_RMC	(1 << 8)
+#define NM_GLL	(1 << 9)
+#define NM_GST	(1 << 10)
+static const char *const nmnames[] = {
+	"GGA", "GNS", "GSA", "GSV", "VTG", "ZDA", "TXT", "UBX", "RMC", "GLL", "GST", NULL,
+};
+static int nmea_use = NM_GGA | NM_GSA | NM_GSV | NM_VTG | NM_ZDA;
+
+static int rate = 1;
+static double speed = 10, turn = 1;
+static double errprob, garbageprob;
+static long maxepochs = -1;
+static int flatout;
+
+/* constellations */
+struct sat {
+	int prn;
+	double elv, azm;
+	int snr;
+};
+
+struct cst {
+	const char *talker;
+	int prnbase;
+	int nsats;
+	struct sat *sats;
+};
+
+static struct cst csts[] = {
+	{ "GP", 1, 12, },
+	{ "GL", 65, 8, },
+	{ "GA", 301, },
+	{ "GB", 201, },
+	{ "GQ", 193, },
+	{ },
+};
+
+/* output */
+static int outfd = STDOUT_FILENO;
+static char obuf[64*1024];
+static size_t olen;
+static unsigned long nsentences, nbytes;
+
+static double frand(void)
+{
+	return rand() / (RAND_MAX + 1.0);
+}
+
+/* udp fleet */
+static const char *udpaddr;
+static int nfleet = 1;
+static int *fleetfds;
+static unsigned long nsenderrs;
+
+static void open_fleet(void)
+{
+	char *host, *port;
+	struct addrinfo hints = {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_DGRAM,
+	}, *res;
+	int j, ret;
+
+	host = strdup(udpaddr);
+	port = strrchr(host, ':');
+	if (!port)
+		mylog(LOG_ERR | LOG_EXIT, "%s: no port", udpaddr);
+	*port++ = 0;
+	ret = getaddrinfo(host, port, &hints, &res);
+	if (ret)
+		mylog(LOG_ERR | LOG_EXIT, "getaddrinfo %s: %s", udpaddr, gai_strerror(ret));
+	fleetfds = calloc(nfleet, sizeof(*fleetfds));
+	if (!fleetfds)
+		mylog(LOG_ERR | LOG_EXIT, "calloc %u sockets: %s", nfleet, ESTR(errno));
+	for (j = 0; j < nfleet; ++j) {
+		fleetfds[j] = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+		if (fleetfds[j] < 0)
+			mylog(LOG_ERR | LOG_EXIT, "socket: %s", ESTR(errno));
+		if (connect(fleetfds[j], res->ai_addr, res->ai_addrlen) < 0)
+			mylog(LOG_ERR | LOG_EXIT, "connect %s: %s", udpaddr, ESTR(errno));
+	}
+	freeaddrinfo(res);
+	free(host);
+}
+
+static void flush_output(void)
+{
+	size_t pos;
+	ssize_t ret;
+	int j;
+
+	if (fleetfds) {
+		/* the same epoch from each tracker */
+		for (j = 0; olen && j < nfleet; ++j) {
+			if (send(fleetfds[j], obuf, olen, 0) < 0)
+				/* the receiver is not listening (yet) */
+				++nsenderrs;
+		}
+		nbytes += olen * nfleet;
+		olen = 0;
+		return;
+	}
+
+	for (pos = 0; pos < olen; pos += ret) {
+		ret = write(outfd, obuf+pos, olen-pos);
+		if (ret < 0 && errno == EINTR)
+			ret = 0;
+		else if (ret < 0)
+			mylog(LOG_ERR | LOG_EXIT, "write: %s", ESTR(errno));
+	}
+	nbytes += olen;
+	olen = 0;
+}
+
+static void emit(const void *dat, size_t len)
+{
+	if (olen + len > sizeof(obuf))
+		flush_output();
+	memcpy(obuf+olen, dat, len);
+	olen += len;
+}
+
+/* emit a sentence, with optional corruption */
+__attribute__((format(printf,1,2)))
+static void sentence(const char *fmt, ...)
+{
+	va_list va;
+	char fmtd[512], line[512];
+	int len, j;
+
+	va_start(va, fmt);
+	vsnprintf(fmtd, sizeof(fmtd), fmt, va);
+	va_end(va);
+	len = nmea_sprintf(line, sizeof(line), "%s", fmtd);
+	if (errprob > 0 && frand() < errprob && len > 8) {
+		/* flip a bit in the body */
+		j = 1 + rand() % (len - 6);
+		line[j] ^= 1 << (rand() % 7);
+	}
+	if (garbageprob > 0 && frand() < garbageprob) {
+		char garbage[64];
+		int glen = 1 + rand() % sizeof(garbage);
+
+		for (j = 0; j < glen; ++j)
+			garbage[j] = rand();
+		emit(garbage, glen);
+	}
+	emit(line, len);
+	++nsentences;
+}
+
+/* ublox NAV-PVT alike frame */
+static void ubx_frame(int cls, int id, const void *payload, int plen)
+{
+	uint8_t frame[8+256];
+	uint8_t cka = 0, ckb = 0;
+	int j;
+
+	frame[0] = 0xb5;
+	frame[1] = 0x62;
+	frame[2] = cls;
+	frame[3] = id;
+	frame[4] = plen;
+	frame[5] = plen >> 8;
+	memcpy(frame+6, payload, plen);
+	for (j = 2; j < 6+plen; ++j) {
+		cka += frame[j];
+		ckb += cka;
+	}
+	frame[6+plen] = cka;
+	frame[7+plen] = ckb;
+	emit(frame, 8+plen);
+	++nsentences;
+}
+
+/* trajectory state */
+static double lat = 51.0, lon = 4.4, heading, alt = 30;
+
+static void move(double dt)
+{
+	double dn, de;
+
+	heading = fmod(heading + turn*dt + 360, 360);
+	dn = speed*dt*cos(heading*M_PI/180);
+	de = speed*dt*sin(heading*M_PI/180);
+	lat += dn / 6371000 * 180 / M_PI;
+	lon += de / (6371000 * cos(lat*M_PI/180)) * 180 / M_PI;
+	alt += (frand() - 0.5) * 0.1;
+}
+
+static void init_sats(void)
+{
+	struct cst *cst;
+	int j;
+
+	for (cst = csts; cst->talker; ++cst) {
+		if (!cst->nsats)
+			continue;
+		cst->sats = calloc(cst->nsats, sizeof(*cst->sats));
+		if (!cst->sats)
+			mylog(LOG_ERR | LOG_EXIT, "calloc: %s", ESTR(errno));
+		for (j = 0; j < cst->nsats; ++j) {
+			cst->sats[j].prn = cst->prnbase + j;
+			cst->sats[j].elv = 5 + frand()*80;
+			cst->sats[j].azm = frand()*360;
+			cst->sats[j].snr = 20 + rand() % 30;
+		}
+	}
+}
+
+static void update_sats(double dt)
+{
+	struct cst *cst;
+	struct sat *sat;
+
+	for (cst = csts; cst->talker; ++cst) {
+		for (sat = cst->sats; sat < cst->sats + cst->nsats; ++sat) {
+			sat->azm = fmod(sat->azm + dt * 0.01 + 360, 360);
+			if (frand() < 0.05*dt)
+				/* lost or regained */
+				sat->snr = sat->snr < 0 ? 20 + rand() % 30 : -1;
+			else if (sat->snr >= 0)
+				sat->snr = sat->snr + (rand() % 3) - 1;
+			if (sat->snr > 55)
+				sat->snr = 55;
+			if (sat->snr >= 0 && sat->snr < 10)
+				sat->snr = 10;
+		}
+	}
+}
+
+static int nactive(void)
+{
+	struct cst *cst;
+	struct sat *sat;
+	int n = 0;
+
+	for (cst = csts; cst->talker; ++cst) {
+		for (sat = cst->sats; sat < cst->sats + cst->nsats; ++sat)
+			n += sat->snr >= 0;
+	}
+	return n;
+}
+
+static char *nmea_deg(char *buf, double val, int londigits, const char *hemi)
+{
+	double deg = floor(fabs(val));
+
+	sprintf(buf, "%0*.0f%08.5f,%c", londigits, deg, (fabs(val) - deg)*60, hemi[val < 0]);
+	return buf;
+}
+
+static void epoch(double t)
+{
+	char hhmmss[32], slat[32], slon[32], line[256], *str;
+	time_t tim = t;
+	struct tm tm;
+	struct cst *cst;
+	struct sat *sat;
+	int j, k, msgcnt, nsat = nactive();
+	double hdop = 0.7 + frand()*0.5;
+	/* round, .60 is .5999.. */
+	int csec = lround((t - tim)*100);
+
+	if (csec >= 100) {
+		++tim;
+		csec -= 100;
+	}
+	gmtime_r(&tim, &tm);
+	sprintf(hhmmss, "%02i%02i%02i.%02i", tm.tm_hour, tm.tm_min, tm.tm_sec, csec);
+	nmea_deg(slat, lat, 2, "NS");
+	nmea_deg(slon, lon, 3, "EW");
+
+	if (nmea_use & NM_GGA)
+		sentence("GPGGA,%s,%s,%s,1,%02i,%.2f,%.1f,M,47.3,M,,", hhmmss, slat, slon, nsat, hdop, alt);
+	if (nmea_use & NM_GNS)
+		sentence("GNGNS,%s,%s,%s,AAAA,%02i,%.2f,%.1f,47.3,,", hhmmss, slat, slon, nsat, hdop, alt);
+	if (nmea_use & NM_VTG)
+		sentence("GPVTG,%.2f,T,,M,%.3f,N,%.3f,K,A", heading, speed*3.6/1.852, speed*3.6);
+	if (nmea_use & NM_ZDA)
+		sentence("GPZDA,%s,%02i,%02i,%04i,00,00", hhmmss, tm.tm_mday, tm.tm_mon+1, tm.tm_year+1900);
+	if (nmea_use & NM_RMC)
+		sentence("GPRMC,%s,A,%s,%s,%.3f,%.2f,%02i%02i%02i,,,A", hhmmss, slat, slon,
+				speed*3.6/1.852, heading, tm.tm_mday, tm.tm_mon+1, tm.tm_year % 100);
+	if (nmea_use & NM_GLL)
+		sentence("GPGLL,%s,%s,%s,A,A", slat, slon, hhmmss);
+	if (nmea_use & NM_GST)
+		sentence("GPGST,%s,%.1f,%.1f,%.1f,%.1f,%.2f,%.2f,%.2f", hhmmss,
+				hdop*2.5, hdop*3, hdop*2, frand()*180, hdop*1.5, hdop*1.3, hdop*3.2);
+	if (nmea_use & NM_GSA) {
+		for (cst = csts, k = 1; cst->talker; ++cst) {
+			if (!cst->nsats)
+				continue;
+			str = line + sprintf(line, "%sGSA,A,3", cst->talker);
+			for (j = 0; j < 12; ++j) {
+				sat = cst->sats + j;
+				if (j < cst->nsats && sat->snr >= 0)
+					str += sprintf(str, ",%02i", sat->prn);
+				else
+					*str++ = ',';
+			}
+			sprintf(str, ",%.2f,%.2f,%.2f,%i", hdop*1.4, hdop, hdop*1.1, k++);
+			sentence("%s", line);
+		}
+	}
+	if (nmea_use & NM_GSV) {
+		for (cst = csts; cst->talker; ++cst) {
+			if (!cst->nsats)
+				continue;
+			msgcnt = (cst->nsats + 3) / 4;
+			for (j = 0; j < msgcnt; ++j) {
+				str = line + sprintf(line, "%sGSV,%i,%i,%02i", cst->talker, msgcnt, j+1, cst->nsats);
+				for (k = j*4; k < (j+1)*4 && k < cst->nsats; ++k) {
+					sat = cst->sats + k;
+					str += sprintf(str, ",%02i,%02.0f,%03.0f,", sat->prn, sat->elv, sat->azm);
+					if (sat->snr >= 0)
+						str += sprintf(str, "%02i", sat->snr);
+				}
+				sentence("%s", line);
+			}
+		}
+	}
+	if ((nmea_use & NM_TXT) && !(tm.tm_sec % 10) && t == floor(t))
+		sentence("GPTXT,01,01,02,synthetic receiver %lu sentences", nsentences);
+	if (nmea_use & NM_UBX) {
+		/* NAV-PVT: iTOW, ..., lon, lat at offset 24, 28 */
+		uint8_t pvt[92] = {};
+		int32_t v32;
+
+		v32 = htole32((int32_t)((tim % 604800) * 1000));
+		memcpy(pvt, &v32, 4);
+		v32 = htole32((int32_t)(lon * 1e7));
+		memcpy(pvt+24, &v32, 4);
+		v32 = htole32((int32_t)(lat * 1e7));
+		memcpy(pvt+28, &v32, 4);
+		pvt[20] = 3;
+		pvt[23] = nsat;
+		ubx_frame(0x01, 0x07, pvt, sizeof(pvt));
+	}
+}
+
+static void parse_constellations(char *str)
+{
+	struct cst *cst;
+	char *tok, *sep;
+
+	for (cst = csts; cst->talker; ++cst)
+		cst->nsats = 0;
+	for (tok = strtok(str, ","); tok; tok = strtok(NULL, ",")) {
+		sep = strchr(tok, ':');
+		if (sep)
+			*sep++ = 0;
+		for (cst = csts; cst->talker; ++cst) {
+			if (!strcasecmp(cst->talker, tok))
+				break;
+		}
+		if (!cst->talker)
+			mylog(LOG_ERR | LOG_EXIT, "unknown constellation '%s'", tok);
+		cst->nsats = sep ? strtoul(sep, NULL, 0) : 8;
+		if (cst->nsats > 36)
+			cst->nsats = 36;
+	}
+}
+
+static int open_pty(const char *link)
+{
+	int fd;
+	struct termios term;
+	const char *name;
+
+	fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (fd < 0)
+		mylog(LOG_ERR | LOG_EXIT, "posix_openpt: %s", ESTR(errno));
+	if (grantpt(fd) < 0 || unlockpt(fd) < 0)
+		mylog(LOG_ERR | LOG_EXIT, "unlockpt: %s", ESTR(errno));
+	name = ptsname(fd);
+	/* raw mode on the master */
+	if (tcgetattr(fd, &term) == 0) {
+		cfmakeraw(&term);
+		tcsetattr(fd, TCSANOW, &term);
+	}
+	if (link) {
+		unlink(link);
+		if (symlink(name, link) < 0)
+			mylog(LOG_ERR | LOG_EXIT, "symlink %s: %s", link, ESTR(errno));
+	}
+	fprintf(stderr, "%s\n", name);
+	return fd;
+}
+
+static const char *ptylink;
+static void my_exit(void)
+{
+	if (ptylink)
+		unlink(ptylink);
+}
+
+static volatile int sigterm;
+static void onsigterm(int sig)
+{
+	sigterm = 1;
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, j;
+	char *tok;
+	long n;
+	unsigned int seed = time(NULL);
+	struct timespec next;
+	double t, dt;
+
+	/* argument parsing */
+	while ((opt = getopt_long(argc, argv, optstring, long_opts, NULL)) >= 0)
+	switch (opt) {
+	case 'V':
+		fprintf(stderr, "%s %s\nCompiled on %s %s\n",
+				NAME, VERSION, __DATE__, __TIME__);
+		exit(0);
+	case 'v':
+		++loglevel;
+		break;
+	case 'c':
+		parse_constellations(optarg);
+		break;
+	case 'r':
+		rate = strtoul(optarg, NULL, 0);
+		if (rate < 1 || rate > 50)
+			mylog(LOG_ERR | LOG_EXIT, "rate %s out of range 1..50", optarg);
+		break;
+	case 'n':
+		nmea_use = 0;
+		for (tok = strtok(optarg, ","); tok; tok = strtok(NULL, ",")) {
+			for (j = 0; nmnames[j]; ++j) {
+				if (!strcasecmp(nmnames[j], tok))
+					break;
+			}
+			if (!nmnames[j])
+				mylog(LOG_ERR | LOG_EXIT, "unknown sentence '%s'", tok);
+			nmea_use |= 1 << j;
+		}
+		break;
+	case 'P':
+		lat = strtod(optarg, &tok);
+		if (*tok == ',')
+			lon = strtod(tok+1, NULL);
+		break;
+	case 'S':
+		speed = strtod(optarg, NULL);
+		break;
+	case 'T':
+		turn = strtod(optarg, NULL);
+		break;
+	case 'e':
+		errprob = strtod(optarg, NULL);
+		break;
+	case 'g':
+		garbageprob = strtod(optarg, NULL);
+		break;
+	case 'N':
+		maxepochs = strtol(optarg, NULL, 0);
+		break;
+	case 'f':
+		flatout = 1;
+		break;
+	case 'o':
+		outfd = open(optarg, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (outfd < 0)
+			mylog(LOG_ERR | LOG_EXIT, "open %s: %s", optarg, ESTR(errno));
+		break;
+	case 't':
+		ptylink = optarg;
+		outfd = open_pty(optarg);
+		break;
+	case 's':
+		seed = strtoul(optarg, NULL, 0);
+		break;
+	case 'u':
+		udpaddr = optarg;
+		break;
+	case 'F':
+		nfleet = strtoul(optarg, NULL, 0);
+		break;
+
+	default:
+		fprintf(stderr, "unknown option '%c'", opt);
+	case '?':
+		fputs(help_msg, stderr);
+		exit(1);
+		break;
+	}
+
+	atexit(my_exit);
+	signal(SIGTERM, onsigterm);
+	signal(SIGINT, onsigterm);
+	srand(seed);
+	init_sats();
+	if (udpaddr)
+		open_fleet();
+
+	dt = 1.0/rate;
+	clock_gettime(CLOCK_REALTIME, &next);
+	/* start on a whole second */
+	t = next.tv_sec + 1;
+	next.tv_sec += 1;
+	next.tv_nsec = 0;
+	for (n = 0; !sigterm && (maxepochs < 0 || n < maxepochs); ++n) {
+		if (!flatout) {
+			if (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &next, NULL) == EINTR)
+				continue;
+			next.tv_nsec += 1000000000 / rate;
+			if (next.tv_nsec >= 1000000000) {
+				next.tv_nsec -= 1000000000;
+				++next.tv_sec;
+			}
+		}
+		/* avoid rounding drift in the sub-second part */
+		t = floor(t) + (n % rate) * dt;
+		epoch(t);
+		move(dt);
+		update_sats(dt);
+		if ((n % rate) == rate-1)
+			t = floor(t) + 1;
+		if (!flatout || fleetfds)
+			flush_output();
+	}
+	flush_output();
+	mylog(LOG_INFO, "%lu epochs, %lu sentences, %lu bytes", n, nsentences * nfleet, nbytes);
+	if (nsenderrs)
+		mylog(LOG_WARNING, "%lu datagrams not sent", nsenderrs);
+	return 0;
+}
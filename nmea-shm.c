@@ -0,0 +1,201 @@
+/*
+ * Copyright 2018 Kurt Van Dijck <dev.kurt@vandijck-laurijssen.be>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <errno.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <getopt.h>
+#include <syslog.h>
+#include <sys/uio.h>
+
+#include "lib/nmeashm.h"
+
+#define NAME "nmea-shm"
+#ifndef VERSION
+#define VERSION "<undefined version>"
+#endif
+
+/* generic error logging */
+#define LOG_EXIT	0x4000000
+
+/* safeguard our LOG_EXIT extension */
+#if (LOG_EXIT & (LOG_FACMASK | LOG_PRIMASK))
+#error LOG_EXIT conflict
+#endif
+
+static int loglevel = LOG_WARNING;
+
+void mylog(int level, const char *fmt, ...)
+{
+	va_list va;
+	char *msg = NULL;
+
+	if ((level & LOG_PRIMASK) <= loglevel) {
+		va_start(va, fmt);
+		vasprintf(&msg, fmt, va);
+		va_end(va);
+
+		struct iovec vec[] = {
+			{ .iov_base = NAME, .iov_len = strlen(NAME), },
+			{ .iov_base = ": ", .iov_len = 2, },
+			{ .iov_base = msg, .iov_len = strlen(msg), },
+			{ .iov_base = "\n", .iov_len = 1, },
+		};
+		writev(STDERR_FILENO, vec, sizeof(vec)/sizeof(vec[0]));
+		free(msg);
+	}
+	if (level & LOG_EXIT)
+		exit(1);
+}
+
+#define ESTR(num)	strerror(num)
+
+/* program options */
+static const char help_msg[] =
+	NAME ": Show the latest fix from nmea0183tomqtt's shared memory\n"
+	"usage:	" NAME " [OPTIONS ...] [NAME]\n"
+	"\n"
+	"Options\n"
+	" -V, --version		Show version\n"
+	" -v, --verbose		Be more verbose\n"
+	" -i, --interval=SEC	Print the fix every SEC seconds (default 1)\n"
+	" -n, --count=N		Stop after N fixes\n"
+	" -s, --sats		Print the satellites too\n"
+	" -b, --bench=N		Measure the time of N snapshots, and exit\n"
+	"\n"
+	"Arguments\n"
+	" NAME		shared memory name, as in nmea0183tomqtt --shm (default /gps)\n"
+	;
+
+#ifdef _GNU_SOURCE
+static struct option long_opts[] = {
+	{ "help", no_argument, NULL, '?', },
+	{ "version", no_argument, NULL, 'V', },
+	{ "verbose", no_argument, NULL, 'v', },
+
+	{ "interval", required_argument, NULL, 'i', },
+	{ "count", required_argument, NULL, 'n', },
+	{ "sats", no_argument, NULL, 's', },
+	{ "bench", required_argument, NULL, 'b', },
+
+	{ },
+};
+#else
+#define getopt_long(argc, argv, optstring, longopts, longindex) \
+	getopt((argc), (argv), (optstring))
+#endif
+static const char optstring[] = "Vv?i:n:sb:";
+
+static int64_t nsec(clockid_t clk)
+{
+	struct timespec ts;
+
+	clock_gettime(clk, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void print_fix(const struct nmeashm_fix *fix, int withsats)
+{
+	int j;
+
+	printf("#%llu %s tod %.2f utc %.2f lat %.7f lon %.7f alt %.1f speed %.2f heading %.2f quality %i hdop %.1f satuse %i age %.3fms\n",
+			(unsigned long long)fix->nupdates, fix->alive ? "alive" : "dead",
+			fix->tod, fix->utc, fix->lat, fix->lon, fix->alt,
+			fix->speed, fix->heading, fix->quality, fix->hdop, fix->satuse,
+			(nsec(CLOCK_MONOTONIC) - fix->updated) / 1e6);
+	if (!withsats)
+		return;
+	for (j = 0; j < fix->nsats; ++j)
+		printf("\tprn %3i elv %2i azm %3i snr %2i\n", fix->sats[j].prn,
+				fix->sats[j].elv, fix->sats[j].azm, fix->sats[j].snr);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, withsats = 0;
+	long j, count = -1, bench = 0;
+	double interval = 1;
+	const char *name = "/gps";
+	const struct nmeashm *shm;
+	struct nmeashm_fix fix;
+	struct timespec ts;
+	int64_t t0;
+
+	/* argument parsing */
+	while ((opt = getopt_long(argc, argv, optstring, long_opts, NULL)) >= 0)
+	switch (opt) {
+	case 'V':
+		fprintf(stderr, "%s %s\nCompiled on %s %s\n",
+				NAME, VERSION, __DATE__, __TIME__);
+		exit(0);
+	case 'v':
+		++loglevel;
+		break;
+	case 'i':
+		interval = strtod(optarg, NULL);
+		break;
+	case 'n':
+		count = strtol(optarg, NULL, 0);
+		break;
+	case 's':
+		withsats = 1;
+		break;
+	case 'b':
+		bench = strtol(optarg, NULL, 0);
+		break;
+
+	default:
+		fprintf(stderr, "unknown option '%c'", opt);
+	case '?':
+		fputs(help_msg, stderr);
+		exit(1);
+		break;
+	}
+
+	if (optind < argc)
+		name = argv[optind];
+	shm = nmeashm_open(name);
+	if (!shm)
+		mylog(LOG_ERR | LOG_EXIT, "open %s: %s", name, ESTR(errno));
+
+	if (bench > 0) {
+		t0 = nsec(CLOCK_MONOTONIC);
+		for (j = 0; j < bench; ++j)
+			nmeashm_read(shm, &fix);
+		printf("%.1f ns/snapshot\n", (double)(nsec(CLOCK_MONOTONIC) - t0) / bench);
+		nmeashm_close(shm);
+		return 0;
+	}
+
+	ts.tv_sec = interval;
+	ts.tv_nsec = fmod(interval, 1) * 1e9;
+	for (; count; count -= count > 0) {
+		nmeashm_read(shm, &fix);
+		print_fix(&fix, withsats);
+		fflush(stdout);
+		if (count != 1)
+			nanosleep(&ts, NULL);
+	}
+	nmeashm_close(shm);
+	return 0;
+}
@@ -30,12 +30,34 @@
 #include <getopt.h>
 #include <fcntl.h>
 #include <locale.h>
+#include <malloc.h>
 #include <poll.h>
+#include <sched.h>
 #include <syslog.h>
 #include <termios.h>
 #include <mosquitto.h>
+#include <netdb.h>
+#include <linux/serial.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "lib/nmea.h"
+#include "lib/nmeashm.h"
+
+#if LIBMOSQUITTO_VERSION_NUMBER >= 1006000
+#define HAVE_MQTT5
+#endif
 
 #define NAME "nmea0183tomqtt"
 #ifndef VERSION
@@ -52,40 +74,193 @@
 
 static int logtostderr = -1;
 
-void mylog(int loglevel, const char *fmt, ...)
+/* logging
+ * Messages are rendered into a ring of slots, which log_drain() writes out.
+ * Before the main loop, mylog() drains at once. The main loop drains
+ * when its events are done, and never blocks on a full stderr pipe.
+ * Each call site (format) may log LOG_BURST messages per LOG_WINDOW seconds,
+ * the excess is only counted, and reported once per window.
+ */
+#define LOG_SLOTS	128
+#define LOG_SLOTSIZE	512
+#define LOG_SITES	64
+#define LOG_BURST	10
+#define LOG_WINDOW	10
+
+struct logslot {
+	int prio;
+	int len;
+	/* where the message starts, after the timestamp */
+	int msg;
+	char text[LOG_SLOTSIZE - 3*sizeof(int)];
+};
+
+struct logsite {
+	const char *fmt;
+	time_t window;
+	int n;
+	int prio;
+	unsigned long suppressed;
+	char last[128];
+};
+
+static struct logslot logring[LOG_SLOTS];
+/* free running, the ring is empty when equal */
+static unsigned int loghead, logtail;
+static unsigned long logdropped;
+/* the main loop drains */
+static int logdefer;
+static struct logsite logsites[LOG_SITES];
+/* the timestamp, rendered once per second */
+static char logstamp[32];
+static time_t logstampsec = -1;
+
+static struct logslot *log_vput(int prio, const struct timespec *tv, const char *fmt, va_list va)
+{
+	struct logslot *slot;
+	int len = 0;
+
+	if (loghead - logtail >= LOG_SLOTS) {
+		++logdropped;
+		return NULL;
+	}
+	slot = logring + loghead % LOG_SLOTS;
+	if (logtostderr) {
+		if (tv->tv_sec != logstampsec) {
+			logstampsec = tv->tv_sec;
+			strftime(logstamp, sizeof(logstamp), "%b %d %H:%M:%S", localtime(&tv->tv_sec));
+		}
+		len = sprintf(slot->text, "%s.%03u " NAME ": ", logstamp, (int)(tv->tv_nsec/1000000));
+	}
+	slot->msg = len;
+	len += vsnprintf(slot->text+len, sizeof(slot->text)-len, fmt, va);
+	/* keep room for the newline */
+	if (len > sizeof(slot->text)-2)
+		len = sizeof(slot->text)-2;
+	slot->prio = prio & LOG_PRIMASK;
+	slot->len = len;
+	++loghead;
+	return slot;
+}
+
+__attribute__((format(printf,3,4)))
+static void log_put(int prio, const struct timespec *tv, const char *fmt, ...)
 {
 	va_list va;
-	char *msg = NULL;
 
-	if (logtostderr < 0)
-		logtostderr = abs(isatty(STDERR_FILENO));
+	va_start(va, fmt);
+	log_vput(prio, tv, fmt, va);
+	va_end(va);
+}
 
-	if (logtostderr) {
-		struct timespec tv;
-		char timbuf[64];
+static void log_drain(int block)
+{
+	struct logslot *slot;
+	struct pollfd pfd = {
+		.fd = STDERR_FILENO,
+		.events = POLLOUT,
+	};
+	struct timespec tv;
 
+	for (; logtail != loghead; ++logtail) {
+		slot = logring + logtail % LOG_SLOTS;
+		if (!logtostderr) {
+			syslog(slot->prio, "%s", slot->text);
+			continue;
+		}
+		if (!block && poll(&pfd, 1, 0) <= 0)
+			/* try again later */
+			return;
+		slot->text[slot->len] = '\n';
+		if (write(STDERR_FILENO, slot->text, slot->len+1) < 0 && errno == EAGAIN && !block)
+			return;
+	}
+	if (logdropped) {
 		clock_gettime(CLOCK_REALTIME, &tv);
-		strftime(timbuf, sizeof(timbuf), "%b %d %H:%M:%S", localtime(&tv.tv_sec));
-		sprintf(timbuf+strlen(timbuf), ".%03u ", (int)(tv.tv_nsec/1000000));
+		log_put(LOG_WARNING, &tv, "%lu log messages dropped", logdropped);
+		logdropped = 0;
+		log_drain(block);
+	}
+}
 
-		va_start(va, fmt);
-		vasprintf(&msg, fmt, va);
-		va_end(va);
+static struct logsite *log_site(const char *fmt)
+{
+	struct logsite *site;
+	int j, idx;
+
+	idx = ((uintptr_t)fmt >> 3) % LOG_SITES;
+	for (j = 0; j < LOG_SITES; ++j) {
+		site = logsites + (idx + j) % LOG_SITES;
+		if (site->fmt == fmt)
+			return site;
+		if (!site->fmt) {
+			site->fmt = fmt;
+			return site;
+		}
+	}
+	/* full, don't limit */
+	return NULL;
+}
 
-		struct iovec vec[] = {
-			{ .iov_base = timbuf, .iov_len = strlen(timbuf), },
-			{ .iov_base = NAME, .iov_len = strlen(NAME), },
-			{ .iov_base = ": ", .iov_len = 2, },
-			{ .iov_base = msg, .iov_len = strlen(msg), },
-			{ .iov_base = "\n", .iov_len = 1, },
-		};
-		writev(STDERR_FILENO, vec, sizeof(vec)/sizeof(vec[0]));
-		free(msg);
-	} else {
-		va_start(va, fmt);
-		vsyslog(loglevel & LOG_PRIMASK, fmt, va);
-		va_end(va);
+/* report the suppressed messages of a call site */
+static void log_repeated(struct logsite *site, const struct timespec *tv)
+{
+	if (!site->suppressed)
+		return;
+	log_put(site->prio, tv, "message repeated %lu times: %s", site->suppressed, site->last);
+	site->suppressed = 0;
+}
+
+/* report the suppressed messages of past windows */
+static void log_tick(void)
+{
+	struct logsite *site;
+	struct timespec tv;
+
+	clock_gettime(CLOCK_REALTIME, &tv);
+	for (site = logsites; site < logsites+LOG_SITES; ++site) {
+		if (site->suppressed && (tv.tv_sec >= site->window + LOG_WINDOW || !logdefer))
+			log_repeated(site, &tv);
+	}
+	log_drain(!logdefer);
+}
+
+void mylog(int loglevel, const char *fmt, ...)
+{
+	va_list va;
+	struct timespec tv;
+	struct logsite *site;
+	struct logslot *slot;
+
+	if (logtostderr < 0)
+		logtostderr = abs(isatty(STDERR_FILENO));
+	if (!logtostderr && !(LOG_MASK(loglevel & LOG_PRIMASK) & setlogmask(0)) && !(loglevel & LOG_EXIT))
+		/* syslog would drop it, don't render it */
+		return;
+
+	clock_gettime(CLOCK_REALTIME, &tv);
+	site = (loglevel & LOG_EXIT) ? NULL : log_site(fmt);
+	if (site) {
+		if (tv.tv_sec >= site->window + LOG_WINDOW) {
+			log_repeated(site, &tv);
+			site->window = tv.tv_sec;
+			site->n = 0;
+		}
+		if (++site->n > LOG_BURST) {
+			++site->suppressed;
+			return;
+		}
+	}
+	va_start(va, fmt);
+	slot = log_vput(loglevel, &tv, fmt, va);
+	va_end(va);
+	if (slot && site) {
+		/* without the timestamp */
+		strncpy(site->last, slot->text + slot->msg, sizeof(site->last)-1);
+		site->prio = loglevel & LOG_PRIMASK;
 	}
+	if (!logdefer || (loglevel & LOG_EXIT))
+		log_drain(1);
 	if (loglevel & LOG_EXIT)
 		exit(1);
 }
@@ -95,12 +270,16 @@ void mylog(int loglevel, const char *fmt, ...)
 /* program options */
 static const char help_msg[] =
 	NAME ": Propagate nmea0183 input to MQTT\n"
-	"usage:	" NAME " [OPTIONS ...] [FILE|DEVICE]\n"
+	"usage:	" NAME " [OPTIONS ...] [FILE|DEVICE ...]\n"
 	"\n"
 	"Options\n"
 	" -V, --version		Show version\n"
 	" -v, --verbose		Be more verbose\n"
-	" -h, --host=HOST[:PORT]Specify alternate MQTT host+port\n"
+	" -h, --host=HOST[:PORT][,HOST[:PORT]...]	Specify alternate MQTT host+port,\n"
+	"			or a list of brokers to spread the load over.\n"
+	"			Each prefix (each source in gateway mode) goes to 1 broker\n"
+	"			by consistent hashing, adding a broker moves only a share of them.\n"
+	"			Each broker gets its own queue, and our alive & will\n"
 	" -n, --nmea=GGA[,ZDA...]	Specify what message to forward, absolute mode\n"
 	" -n, --nmea=+/-GGA[,+/-ZDA...]	Specify what message to forward, relative mode\n"
 	"		Possible messages are:\n"
@@ -110,6 +289,9 @@ static const char help_msg[] =
 	"		 GSV	Satellites in view info\n"
 	"		*VTG	Speed & heading\n"
 	"		*ZDA	GPS time\n"
+	"		 RMC	lon, lat, speed, heading & GPS time in 1 sentence\n"
+	"		 GLL	lon, lat\n"
+	"		 GST	accuracy/lat, lon, alt & rms, in meters\n"
 	"		Default: GGA,ZDA,VTG\n"
 	" -a, --always		Publish everything on reception, always\n"
 	"			By default, publish topics only when something changed in the same block\n"
@@ -119,19 +301,110 @@ static const char help_msg[] =
 	"			Adding -a may produce a lot of equal noise\n"
 	" -p, --prefix=PREFIX	Prefix MQTT topics, including final slash, default to 'gps/'\n"
 	" -d, --deadtime=DELAY	Consider port dead after DELAY seconds of silence (default 10)\n"
+	"			DELAY may be fractional, like 0.3\n"
 	" -D, --default=TK	Set a default talker (GP, GL, GB, GA, GN, ...)\n"
 	"			The default talker's mode & dop will be published\n"
 	"			without talker prefix for compatibility\n"
 	"			Set to '0' to have no default talker\n"
+	" -o, --output=FILE	Write 'TOPIC PAYLOAD' lines to FILE instead of MQTT\n"
+	"			Use '-' for stdout\n"
+	" -R, --resume		Seed the cache from the retained topics on the broker at startup\n"
+	"			Equal values are not published again,\n"
+	"			retained topics that are not refreshed within DELAY\n"
+	"			(see --deadtime) are cleared\n"
+	" -5, --mqtt5		Use MQTT v5, with topic aliases for recurring data topics\n"
+	" -e, --expiry=SEC	Let data, sat & event messages expire after SEC seconds (MQTT v5)\n"
+	" -q, --qos=CLASS=QOS[,CLASS=QOS...]	Set the QoS per topic class\n"
+	"			Classes are alive, state (src, ...), data (fixes),\n"
+	"			sat (satellites in view) and event (txt, journal)\n"
+	"			Default QoS: 0 for localhost, 1 otherwise\n"
+	" -Q, --queue=BYTES	Limit the outbound queue to BYTES (default 1M)\n"
+	"			While the broker is slow or unreachable,\n"
+	"			retained topics keep only their latest value,\n"
+	"			events drop the oldest, 'alive' is never dropped\n"
+	" -I, --inflight=N	Limit unacknowledged messages for QoS>0 (default 20)\n"
+	" -J, --journal=FILE[,SIZE]	Store & forward: while the broker is unreachable,\n"
+	"			append 1 record per epoch to FILE, limited to SIZE (default 1M)\n"
+	"			and replay them afterwards to <PREFIX>/journal as\n"
+	"			'tod,utc,lat,lon,alt,speed,heading,quality'\n"
+	" -r, --journal-rate=N	Replay at most N records per second (default 10)\n"
+	" -s, --select=POLICY	Select the input with redundant receivers\n"
+	"			alive: leave an input only when it's dead\n"
+	"			fix: also leave an input without fix\n"
+	"			best: also switch to a better fix quality, satuse or hdop (default)\n"
+	"			The primary is preferred when equal\n"
+	" -T, --stats=SEC	Log statistics every SEC seconds\n"
+	"			Per input, also publish under <PREFIX>stat/ (<PREFIX>stat/<N>/\n"
+	"			with several inputs): epochs, period (learned from the time\n"
+	"			of day), missed & repeated epochs, gsvgaps (incomplete GSV\n"
+	"			sequences), bad (checksums), clock (system - GNSS time,\n"
+	"			last min max), and for serial ports uart/overrun, uart/bufoverrun\n"
+	"			& uart/frame\n"
+	" -m, --shm=NAME		Keep the latest fix & satellites in POSIX shared memory NAME\n"
+	"			like /gps, for local readers (see lib/nmeashm.h & nmea-shm)\n"
+	" -G, --gpsd=ADDR	Serve gpsd JSON (TPV & SKY reports) on ADDR,\n"
+	"			a unix socket PATH or [HOST:]PORT (gpsd uses 2947)\n"
+	" -g, --gateway=[udp:|tcp:][HOST:]PORT	Gateway mode: receive NMEA from many trackers\n"
+	"			over UDP (default) or TCP, instead of FILE|DEVICE. Repeatable.\n"
+	"			Each source publishes under <PREFIX><ID>/,\n"
+	"			each worker publishes alive & src under <PREFIX>gateway/<N>/\n"
+	" -W, --workers=N	Spread the trackers over N worker processes (default 1)\n"
+	" -i, --source-id=SENTENCE	Identify a source by the 1st field of SENTENCE, like PTRKID\n"
+	"			By default, the ID is IP:PORT for UDP and IP for TCP\n"
+	" -S, --schema=FILE	Decode extra (proprietary) sentences as described in FILE\n"
+	"			1 field per line: 'SENTENCE FIELD TYPE SCALE TOPIC'\n"
+	"			SENTENCE	PASHR, PUBX,00 (matching field 1), or HDT (any talker)\n"
+	"			FIELD	field index, 1 is the first field after the sentence id\n"
+	"			TYPE	int, float[.DECIMALS], str, or deg (DDMM.MMM + N/S/E/W field)\n"
+	"			SCALE	multiplier for int & float\n"
+	"			TOPIC	topic under PREFIX, and under the talker for HDT-alike\n"
+	"			These decoders precede the built-in ones, and ignore --nmea\n"
+	" -t, --throughput	Favour throughput, for replay & bulk ingest:\n"
+	"			read up to 64k at once, and publish the topics of all sentences\n"
+	"			per epoch (time of day change) or per read, instead of per sentence.\n"
+	"			A changed sentence is still published with all its topics\n"
+	" -L, --lowlatency[=PRIO[,CPU]]	Favour latency over CPU: busy poll the inputs,\n"
+	"			push each sentence to the socket at once, lock & prefault memory,\n"
+	"			and ask serial ports for low latency.\n"
+	"			PRIO runs with SCHED_FIFO priority PRIO, CPU pins to CPU.\n"
+	"			The statistics (see --stats) add the publish latency\n"
+	" -k, --track=METERS	Publish a simplified track of the GGA/GNS positions to\n"
+	"			<PREFIX>track, as 'LAT LON [UTC]' vertices.\n"
+	"			The skipped positions lie within METERS of the track\n"
+	" -f, --geofence=FILE[,DWELL]	Test each fix against the (Multi)Polygon features\n"
+	"			of GeoJSON FILE, named by property 'name' or 'id'.\n"
+	"			Publish 'enter', 'exit', and 'dwell' after DWELL seconds\n"
+	"			inside (default 60, 0 disables), to <PREFIX>geofence/<NAME>\n"
+	" -E, --ecef		Publish <PREFIX>ecef as 'X Y Z' (m, WGS84) from GGA/GNS\n"
+	" -U, --utm		Publish <PREFIX>utm as 'ZONEBAND EASTING NORTHING' from GGA/GNS\n"
+	" -O, --origin=LAT,LON[,ALT]	Publish <PREFIX>enu as 'EAST NORTH UP' (m),\n"
+	"			relative to the origin (ALT is ellipsoidal)\n"
+	" -P, --predict=HZ	Publish <PREFIX>predict as 'LAT LON' HZ times per second,\n"
+	"			extrapolated to now by a constant velocity tracker,\n"
+	"			up to 2 epochs after the last fix\n"
+	" -j, --jobs=N		Batch mode: convert a regular FILE using N parallel workers\n"
+	"			The file is split in chunks at sentence boundaries,\n"
+	"			the results are merged in order.\n"
+	"			Retained topics are not erased at the end.\n"
 	"\n"
 	"Arguments\n"
 	" FILE|DEVICE	Read input from FILE or DEVICE\n"
+	"		With more inputs, the first is the primary receiver,\n"
+	"		the others are secondary receivers.\n"
+	"		All are parsed, the selected input publishes.\n"
+	"		A switch is published on <PREFIX>/switch as 'OLD NEW',\n"
+	"		and <PREFIX>/src follows the selected input\n"
 	"\n"
 	"Runtime configuration via MQTT\n"
 	" <PREFIX>/cfg/msgs	identical to --nmea parameter\n"
 	" <PREFIX>/cfg/always	set --always parameter\n"
 	" <PREFIX>/cfg/deadtime	set --deadtime parameter\n"
 	" <PREFIX>/cfg/default	set --default parameter\n"
+	" <PREFIX>/cfg/geofence	reload the geofences from FILE, or from GeoJSON text,\n"
+	"			empty reloads the current FILE\n"
+	"\n"
+	"Signals\n"
+	" SIGUSR1	Log statistics\n"
 	;
 
 #ifdef _GNU_SOURCE
@@ -146,6 +419,32 @@ static struct option long_opts[] = {
 	{ "always", no_argument, NULL, 'a', },
 	{ "deadtime", required_argument, NULL, 'd', },
 	{ "default", required_argument, NULL, 'D', },
+	{ "output", required_argument, NULL, 'o', },
+	{ "select", required_argument, NULL, 's', },
+	{ "stats", required_argument, NULL, 'T', },
+	{ "jobs", required_argument, NULL, 'j', },
+	{ "resume", no_argument, NULL, 'R', },
+	{ "mqtt5", no_argument, NULL, '5', },
+	{ "expiry", required_argument, NULL, 'e', },
+	{ "qos", required_argument, NULL, 'q', },
+	{ "queue", required_argument, NULL, 'Q', },
+	{ "inflight", required_argument, NULL, 'I', },
+	{ "journal", required_argument, NULL, 'J', },
+	{ "journal-rate", required_argument, NULL, 'r', },
+	{ "schema", required_argument, NULL, 'S', },
+	{ "shm", required_argument, NULL, 'm', },
+	{ "gpsd", required_argument, NULL, 'G', },
+	{ "gateway", required_argument, NULL, 'g', },
+	{ "workers", required_argument, NULL, 'W', },
+	{ "source-id", required_argument, NULL, 'i', },
+	{ "lowlatency", optional_argument, NULL, 'L', },
+	{ "throughput", no_argument, NULL, 't', },
+	{ "track", required_argument, NULL, 'k', },
+	{ "geofence", required_argument, NULL, 'f', },
+	{ "ecef", no_argument, NULL, 'E', },
+	{ "utm", no_argument, NULL, 'U', },
+	{ "origin", required_argument, NULL, 'O', },
+	{ "predict", required_argument, NULL, 'P', },
 
 	{ },
 };
@@ -153,35 +452,88 @@ static struct option long_opts[] = {
 #define getopt_long(argc, argv, optstring, longopts, longindex) \
 	getopt((argc), (argv), (optstring))
 #endif
-static const char optstring[] = "Vv?h:n:p:ad:D:";
+static const char optstring[] = "Vv?h:n:p:ad:D:o:s:T:j:R5e:q:Q:I:J:r:S:m:G:g:W:i:L::tk:f:EUO:P:";
 
 /* signal handler */
 static volatile int sigterm;
-static volatile int sigalrm;
 static volatile int ready;
 
 /* MQTT parameters */
-static const char *mqtt_host = "localhost";
+static char *mqtt_host = "localhost";
 static int mqtt_port = 1883;
 static int mqtt_keepalive = 10;
 static int mqtt_qos = -1;
 
 static char *file = "<stdin>";
 
-/* state */
-static struct mosquitto *mosq;
-
-static char nmea_use[] = "+gga,-gns,-gsa,-gsv,+vtg,+zda\0\0";
+static char nmea_use[] = "+gga,-gns,-gsa,-gsv,+vtg,+zda,-rmc,-gll,-gst\0\0";
 static const char *def_talker = "gp";
 static char *def_talker_mqtt;
 static const char *topicprefix = "gps/";
 static int topicprefixlen = 4;
 static int always;
-static int deaddelay = 10;
+/* msec */
+static int deadtime = 10000;
+static int statsinterval;
 static int portalive = -1;
+static int jobs;
+/* time of day of the last fix */
+static double epoch_tod = NAN;
+/* unix time of 00:00 UTC of the last known date, or -1,
+ * and the time of day last converted with it
+ */
+static long utcday = -1;
+static double utctod = NAN;
+static int resume;
+/* seeding the cache from retained topics */
+static int seeding;
+static time_t seedsweep;
+
+/* output sink, when not using MQTT */
+static FILE *outfile;
+/* prefix each line with the retain flag, used to merge batch workers into MQTT */
+static int outfile_retain;
 
 static char talker[3] = {};
 
+/* track simplification tolerance, meters */
+static double track_tol;
+/* throughput mode */
+static int throughput;
+/* low latency mode */
+static int lowlatency;
+static int rtprio;
+static int rtcpu = -1;
+
+/* shared memory latest fix */
+static const char *shmname;
+static struct nmeashm *shm;
+/* gpsd server */
+static const char *gpsdaddr;
+static int gpsdfd = -1;
+/* parsed fix, committed to shm & gpsd after each sentence */
+static struct nmeashm_fix lastfix = {
+	.quality = -1,
+	.tod = NAN,
+	.utc = NAN,
+	.lat = NAN,
+	.lon = NAN,
+	.alt = NAN,
+	.speed = NAN,
+	.heading = NAN,
+	.hdop = NAN,
+};
+#define FIX_POS		1
+#define FIX_SATS	2
+static int fixdirty;
+/* GSA details, for gpsd */
+static int fixmode;
+static double fixmodetod = NAN;
+#define MAXUSED	64
+static int usedprns[MAXUSED];
+static int nusedprns;
+static double usedtod = NAN;
+
 /* nmea tables */
 static const char *const strquality[] = {
 	[0] = "none",
@@ -202,10 +554,25 @@ static const char *const strmode[] = {
 
 #define fromtable(table, idx)	(((idx) >= sizeof(table)/sizeof((table)[0])) ? NULL : (table)[idx])
 
+static void journal_sync(void);
+static void journal_end_epoch(void);
+static void shm_exit(void);
+static void mqtt_exit(void);
+static void lowlat_push(void);
+static void gpsd_fix(int dirty);
+/* network gateway */
+struct peer;
+static struct peer *curpeer;
+static int peer_identify(struct peer *peer, const char *tok);
+
 static void my_exit(void)
 {
-	if (mosq)
-		mosquitto_disconnect(mosq);
+	journal_sync();
+	shm_exit();
+	mqtt_exit();
+	/* write out what's left */
+	logdefer = 0;
+	log_tick();
 }
 
 /* message list api */
@@ -242,6 +609,7 @@ static void merge_nmea_use(char *msgs)
 
 static void clear_gsvs(void);
 static void satuse_updated(const char *talker, int satuse);
+static void seed_topic(const char *topic, const char *payload);
 
 /* MQTT API */
 static char *myuuid;
@@ -265,765 +633,4914 @@ static int is_self_sync(const struct mosquitto_message *msg)
 		!strncmp(myuuid ?: "", msg->payload ?: "", msg->payloadlen);
 }
 
-static void my_mqtt_msg(struct mosquitto *mosq, void *dat, const struct mosquitto_message *msg)
-{
-#define cfgprefix "cfg/"
-#define cfgprefixlen 4
-
-	if (is_self_sync(msg))
-		ready = 1;
-
-	if (!strncmp(msg->topic, topicprefix, topicprefixlen) &&
-			!strncmp(msg->topic+topicprefixlen, cfgprefix, cfgprefixlen)) {
-		const char *stopic = msg->topic + topicprefixlen + cfgprefixlen;
-
-		if (!strcmp(stopic, "msgs")) {
-			if (!msg->payloadlen)
-				return;
-			int gsv = nmea_use_msg("gsv");
-			merge_nmea_use((char *)msg->payload);
-			mylog(LOG_NOTICE, "nmea msgs changed to '%s'", nmea_use);
-			if (gsv && !nmea_use_msg("gsv"))
-				clear_gsvs();
-
-		} else if (!strcmp(stopic, "always")) {
-			always = strtoul((char *)msg->payload ?: "0", NULL, 0);
-			mylog(LOG_NOTICE, "--%s changed to %u", stopic, always);
-
-		} else if (!strcmp(stopic, "deadtime")) {
-			deaddelay = strtoul((char *)msg->payload ?: "10", NULL, 0);
-			mylog(LOG_NOTICE, "--%s changed to %u", stopic, deaddelay);
-
-		} else if (!strcmp(stopic, "default")) {
-			if (def_talker_mqtt)
-				free(def_talker_mqtt);
-			def_talker_mqtt = msg->payloadlen ? strdup(msg->payload) : NULL;
-			mylog(LOG_NOTICE, "--%s changed to %s", stopic, def_talker_mqtt ?: def_talker);
-		}
-	}
-}
-
-/* cache per NMEA message */
+/* cache per NMEA message
+ * Topics are never removed, so they live in slabs,
+ * and their names in a string arena.
+ * Short payloads are stored inline,
+ * longer payloads keep their heap buffer for reuse.
+ * This avoids heap allocations in steady state.
+ */
+#define TOPIC_INLINE	24
 struct topic {
 	struct topic *next;
+	/* written since the last flush */
+	struct topic *wnext;
 	int written;
 	int retain;
 	int ctrltopic;
+	/* recvd from broker, not yet refreshed */
+	int seeded;
+	/* topic class & MQTT v5 topic alias */
+	int cls;
+	int alias;
+	unsigned int aliasgen;
 	char *topic;
+	/* NULL, inl or heap */
 	char *payload;
+	char *heap;
+	int heapsize;
+	char inl[TOPIC_INLINE];
 };
 
-static struct topic *topics, *lasttopic;
-static int ndirty;
-static int in_data_sentence;
-
-__attribute__((format(printf,1,2)))
-static const char *mktopic(const char *fmt, ...)
-{
-	va_list va;
-	static char topic[1024];
-
-	va_start(va, fmt);
-	vsnprintf(topic, sizeof(topic), fmt, va);
-	va_end(va);
-	return topic;
-}
-
 #define FL_RETAIN		(1 << 0)
 #define FL_IGN_DEF_TALKER	(1 << 1)
 #define FL_NO_CACHE		(1 << 2)
+/* published by a sentence handler */
+#define FL_DATA			(1 << 3)
+
+/* outbound queue
+ * While the broker is slow or unreachable, messages wait here,
+ * within <qlimit> bytes.
+ * Retained state keeps only its latest value,
+ * events drop the oldest, 'alive' is never dropped.
+ */
+enum {
+	TC_ALIVE,
+	TC_STATE,
+	TC_DATA,
+	TC_SAT,
+	TC_EVENT,
+	NCLASSES,
+};
 
-#define publish_topic(topic, vfmt, ...) publish_topicrt(talker, (topic), FL_RETAIN, (vfmt), ##__VA_ARGS__)
-#define publish_topicr(topic, flags, vfmt, ...) publish_topicrt(talker, (topic), (flags), (vfmt), ##__VA_ARGS__)
+static const char *const strclass[NCLASSES] = {
+	[TC_ALIVE] = "alive",
+	[TC_STATE] = "state",
+	[TC_DATA] = "data",
+	[TC_SAT] = "sat",
+	[TC_EVENT] = "event",
+};
+/* QoS per class, -1 for mqtt_qos */
+static int class_qos[NCLASSES] = { -1, -1, -1, -1, -1, };
+
+struct msg {
+	struct msg *next, *prev;
+	/* hash chain of queued retained topics */
+	struct msg *hnext;
+	/* cache entry, if any */
+	struct topic *it;
+	int cls;
+	int retain;
+	size_t size;
+	char *payload;
+	char topic[];
+};
 
-static void publish_cache(const char *realtopic, const char *value, int retain);
-__attribute__((format(printf,4,5)))
-static void publish_topicrt(const char *talker, const char *topic, int flags, const char *vfmt, ...)
-{
-	va_list va;
-	static char value[1024];
-	static char realtopic[1024];
+#define QHASH_SIZE	256
+static size_t qlimit = 1 << 20;
+
+/* MQTT v5 */
+static int mqtt5;
+/* connection generations, aliases are per connection */
+static unsigned int mqtt_gen;
+/* message expiry for data, sat & events */
+static int expiry;
+static int maxinflight = 20;
+
+/* brokers
+ * With more brokers, each topic prefix (each source in gateway mode)
+ * goes to 1 broker, by consistent hashing.
+ * Each connection has its own outbound queue, state & will.
+ */
+struct broker {
+	struct mosquitto *mosq;
+	char *host;
+	int port;
+	/* connection state */
+	int connected;
+	int ninflight;
+	time_t reconnect_time;
+	int reconnect_delay;
+	/* outbound queue */
+	struct msg *qhead, *qtail;
+	struct msg *qhash[QHASH_SIZE];
+	size_t qbytes;
+	unsigned long qlen, qdropped, qcoalesced;
+	/* MQTT v5 aliases */
+	int alias_max, alias_next;
+	unsigned int gen;
+	/* QoS>0 mids in flight */
+	uint8_t midqos[65536/8];
+	/* the socket & events being watched */
+	int fd;
+	uint32_t events;
+};
 
-	if (vfmt) {
-		va_start(va, vfmt);
-		vsprintf(value, vfmt, va);
-		va_end(va);
-	} else
-		value[0] = 0;
+static struct broker *brokers;
+static int nbrokers;
+/* the broker of <topicprefix> */
+static struct broker *curbroker;
+/* <prefix>alive of this process, the will of each connection */
+static char *willtopic;
+static char alivepayload[8];
+
+/* the consistent hash ring
+ * Each broker owns BROKER_VNODES points,
+ * a prefix goes to the first point at or after its hash.
+ * Adding a broker only moves the prefixes that hash near its points.
+ */
+#define BROKER_VNODES	160
+struct vnode {
+	unsigned int hash;
+	int idx;
+};
+static struct vnode *ring;
+static int nring;
 
-	if (!strcmp(value, "nan"))
-		strcpy(value, "");
+static void broker_add(char *host)
+{
+	struct broker *b;
+	char *str;
 
-	if (talker && ((flags & FL_IGN_DEF_TALKER) || strcmp(talker, def_talker_mqtt ?: def_talker)))
-		sprintf(realtopic, "%s%s/%s", topicprefix, talker, topic);
-	else
-		sprintf(realtopic, "%s%s", topicprefix, topic);
+	brokers = realloc(brokers, (nbrokers+1) * sizeof(*brokers));
+	if (!brokers)
+		mylog(LOG_ERR | LOG_EXIT, "realloc %u brokers: %s", nbrokers+1, ESTR(errno));
+	b = brokers + nbrokers++;
+	memset(b, 0, sizeof(*b));
+	b->host = host;
+	b->port = mqtt_port;
+	b->fd = -1;
+	str = strrchr(host, ':');
+	if (str > host && *(str-1) != ']') {
+		/* TCP port provided */
+		*str = 0;
+		b->port = strtoul(str+1, NULL, 10);
+	}
+}
 
-	publish_cache(realtopic, value, flags);
+static unsigned int ring_hash(const char *str)
+{
+	unsigned int hash = 2166136261u;
+
+	for (; *str; ++str)
+		hash = (hash ^ *(const unsigned char *)str) * 16777619u;
+	/* FNV-1a leaves the high bits poorly mixed */
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35u;
+	hash ^= hash >> 16;
+	return hash;
 }
 
-static void publish_cache(const char *realtopic, const char *value, int flags)
+static int vnode_cmp(const void *va, const void *vb)
 {
-	int ret;
-	struct topic *it;
+	const struct vnode *a = va, *b = vb;
 
-	if (!(flags & FL_RETAIN) || (flags & FL_NO_CACHE)) {
-		ret = mosquitto_publish(mosq, NULL, realtopic, strlen(value), value, mqtt_qos, flags & FL_RETAIN);
-		if (ret)
-			mylog(LOG_ERR | LOG_EXIT, "mosquitto_publish %s: %s", realtopic, mosquitto_strerror(ret));
-		return;
-	}
+	return (a->hash > b->hash) - (a->hash < b->hash);
+}
 
-	for (it = topics; it; it = it->next) {
-		if (!strcmp(it->topic, realtopic))
-			break;
-	}
-	if (!it) {
-		it = malloc(sizeof(*it));
-		if (!it)
-			mylog(LOG_ERR | LOG_EXIT, "malloc failed: %s", ESTR(errno));
-		memset(it, 0, sizeof(*it));
-		/* append to linked list */
-		if (!topics) {
-			topics = lasttopic = it;
-		} else {
-			lasttopic->next = it;
-			lasttopic = it;
+static void ring_init(void)
+{
+	int j, k;
+	char key[128];
+
+	nring = nbrokers * BROKER_VNODES;
+	ring = calloc(nring, sizeof(*ring));
+	if (!ring)
+		mylog(LOG_ERR | LOG_EXIT, "calloc %u vnodes: %s", nring, ESTR(errno));
+	for (j = 0; j < nbrokers; ++j) {
+		for (k = 0; k < BROKER_VNODES; ++k) {
+			/* by address, so the order of the list does not matter */
+			snprintf(key, sizeof(key), "%s:%i#%i", brokers[j].host, brokers[j].port, k);
+			ring[j*BROKER_VNODES+k].hash = ring_hash(key);
+			ring[j*BROKER_VNODES+k].idx = j;
 		}
-		it->topic = strdup(realtopic);
-		/* save 'retain' only once */
-		it->retain = 1;
-		it->ctrltopic = !in_data_sentence;
-	}
-	it->written = 1;
-	if (strcmp(it->payload ?: "", value)) {
-		if (it->payload)
-			free(it->payload);
-		it->payload = strdup(value);
-		++ndirty;
 	}
+	qsort(ring, nring, sizeof(*ring), vnode_cmp);
 }
 
-static void flush_pending_topics(void)
+static struct broker *broker_for(const char *prefix)
 {
-	struct topic *it;
-	int ret;
-
-	for (it = topics; it; it = it->next) {
-		/* publish cache */
-		if (it->written && (ndirty || always)) {
-			ret = mosquitto_publish(mosq, NULL, it->topic, strlen(it->payload ?: ""), it->payload, mqtt_qos, it->retain);
-			if (ret)
-				mylog(LOG_ERR | LOG_EXIT, "mosquitto_publish %s: %s", it->topic, mosquitto_strerror(ret));
-		}
-		it->written = 0;
+	unsigned int hash;
+	int lo, hi, mid;
+
+	if (nbrokers < 2)
+		return brokers;
+	hash = ring_hash(prefix);
+	for (lo = 0, hi = nring; lo < hi; ) {
+		mid = (lo + hi) / 2;
+		if (ring[mid].hash < hash)
+			lo = mid+1;
+		else
+			hi = mid;
 	}
-	ndirty = 0;
+	/* wrap around */
+	return brokers + ring[lo % nring].idx;
 }
 
-static void erase_topics(int clrctrl)
+static int topic_class(const char *topic, int flags)
 {
-	struct topic *it;
+	if (!(flags & FL_RETAIN))
+		return TC_EVENT;
+	if (!strncmp(topic, topicprefix, topicprefixlen) && !strcmp(topic+topicprefixlen, "alive"))
+		return TC_ALIVE;
+	if (flags & FL_NO_CACHE)
+		return TC_SAT;
+	if (flags & FL_DATA)
+		return TC_DATA;
+	return TC_STATE;
+}
 
-	for (it = topics; it; it = it->next) {
-		if (it->ctrltopic && !clrctrl)
-			continue;
-		if (!it->payload)
-			/* nothting to erase */
-			continue;
-		/* clear cached value, and mark as dirty */
-		free(it->payload);
-		it->payload = NULL;
-		it->written = 1;
-		++ndirty;
-	}
-	flush_pending_topics();
+static unsigned int qhash_idx(const char *topic)
+{
+	unsigned int hash = 2166136261u;
+
+	for (; *topic; ++topic)
+		hash = (hash ^ *(const unsigned char *)topic) * 16777619u;
+	return hash % QHASH_SIZE;
 }
 
-/* nmea parser */
-static char *nmea_tok(char *line)
+static void outq_del(struct broker *b, struct msg *m)
 {
-	static char *saved_line;
-	char *str;
+	struct msg **pm;
 
-	if (!line)
-		line = saved_line;
-	else if (*line == '$')
-		/* omit leading $ */
-		++line;
+	if (m->cls != TC_EVENT) {
+		for (pm = &b->qhash[qhash_idx(m->topic)]; *pm; pm = &(*pm)->hnext) {
+			if (*pm == m) {
+				*pm = m->hnext;
+				break;
+			}
+		}
+	}
+	if (m->prev)
+		m->prev->next = m->next;
+	else
+		b->qhead = m->next;
+	if (m->next)
+		m->next->prev = m->prev;
+	else
+		b->qtail = m->prev;
+	b->qbytes -= m->size;
+	--b->qlen;
+	free(m);
+}
 
-	for (str = line; *str; ++str) {
-		if (strchr(",", *str)) {
-			*str++ = 0;
-			break;
+/* drop the oldest event, or else the oldest state */
+static int outq_drop(struct broker *b)
+{
+	struct msg *m;
+	int cls;
+
+	for (cls = TC_EVENT; cls > TC_ALIVE; --cls) {
+		for (m = b->qhead; m; m = m->next) {
+			if (m->cls == cls) {
+				outq_del(b, m);
+				return 1;
+			}
 		}
 	}
-	saved_line = str;
-	return *line ? line : NULL;
+	return 0;
 }
-static inline char *nmea_safe_tok(char *line)
+
+static void outq_add(struct broker *b, struct topic *it, const char *topic, const char *payload, int retain, int cls)
 {
-	return nmea_tok(line) ?: "";
+	struct msg *m;
+	size_t toplen = strlen(topic)+1, paylen = strlen(payload)+1;
+	unsigned int idx = 0;
+
+	if (cls != TC_EVENT) {
+		/* replace a pending value */
+		idx = qhash_idx(topic);
+		for (m = b->qhash[idx]; m; m = m->hnext) {
+			if (!strcmp(m->topic, topic)) {
+				outq_del(b, m);
+				++b->qcoalesced;
+				break;
+			}
+		}
+	}
+	m = malloc(sizeof(*m) + toplen + paylen);
+	if (!m)
+		mylog(LOG_ERR | LOG_EXIT, "malloc: %s", ESTR(errno));
+	m->it = it;
+	m->cls = cls;
+	m->retain = retain;
+	m->size = sizeof(*m) + toplen + paylen;
+	memcpy(m->topic, topic, toplen);
+	m->payload = m->topic + toplen;
+	memcpy(m->payload, payload, paylen);
+
+	m->next = NULL;
+	m->prev = b->qtail;
+	if (b->qtail)
+		b->qtail->next = m;
+	else
+		b->qhead = m;
+	b->qtail = m;
+	if (cls != TC_EVENT) {
+		m->hnext = b->qhash[idx];
+		b->qhash[idx] = m;
+	}
+	b->qbytes += m->size;
+	++b->qlen;
+
+	while (b->qbytes > qlimit) {
+		if (!outq_drop(b))
+			break;
+		if (!b->qdropped++)
+			mylog(LOG_WARNING, "mqtt %s:%i outbound queue full, dropping messages", b->host, b->port);
+	}
 }
 
-/* parse DDDMM.MMMMM to double */
-static double nmea_deg_to_double(const char *str)
+static unsigned long outq_pending(void)
 {
-	long lval;
-	char *endp;
+	struct broker *b;
+	unsigned long n = 0;
 
-	if (!*str)
-		return NAN;
-	lval = strtol(str, &endp, 10);
-	return ((lval %100)+ strtod(endp, 0))/60.0 + (lval /100);
+	for (b = brokers; b < brokers+nbrokers; ++b)
+		n += b->qlen;
+	return n;
 }
-static inline double nmea_strtod(const char *str)
+
+static void mqtt_lost(struct broker *b, int ret)
 {
-	return *str ? strtod(str, NULL) : NAN;
+	if (b->connected)
+		mylog(LOG_WARNING, "mqtt %s:%i connection lost: %s", b->host, b->port, mosquitto_strerror(ret));
+	b->connected = 0;
+	/* libmosquitto retries those itself, uncounted */
+	b->ninflight = 0;
+	memset(b->midqos, 0, sizeof(b->midqos));
+	/* the socket is closed, and left the epoll set */
+	b->fd = -1;
+	b->events = 0;
 }
 
-static int nmea_is_valid_sentence(char *line)
+static void mqtt_reconnect(struct broker *b)
 {
-	char *str;
-	uint8_t nmea_sum, my_sum;
+	int ret;
+	time_t now;
 
-	if ('$' != *line) {
-		mylog(LOG_WARNING, "bad nmea message '%.10s'", line);
-		return -1;
-	}
+	if (b->connected || mosquitto_socket(b->mosq) >= 0)
+		/* connected, or connecting */
+		return;
+	now = time(NULL);
+	if (now < b->reconnect_time)
+		return;
+	b->reconnect_delay = b->reconnect_delay ? b->reconnect_delay*2 : 1;
+	if (b->reconnect_delay > 60)
+		b->reconnect_delay = 60;
+	b->reconnect_time = now + b->reconnect_delay;
+	/* the new socket may reuse the old number */
+	b->fd = -1;
+	b->events = 0;
+	ret = mosquitto_reconnect_async(b->mosq);
+	if (ret)
+		mylog(LOG_INFO, "mosquitto_reconnect %s:%i: %s, retry in %us",
+				b->host, b->port, mosquitto_strerror(ret), b->reconnect_delay);
+}
 
-	/* make my sum, start after initial $ */
-	for (str = line+1, my_sum = 0; *str; ++str) {
-		if (*str == '*') {
-			/* cut checksum field */
-			*str = 0;
-			/* end of sentence */
-			nmea_sum = strtoul(str+1, NULL, 16);
-			if (my_sum != nmea_sum) {
-				mylog(LOG_WARNING, "bad sum on nmea msg '%.10s'", line);
-				return -1;
-			}
-			return 0;
+#ifdef HAVE_MQTT5
+static int mqtt5_send(struct broker *b, int *mid, struct topic *it, const char *topic, const char *payload, int retain, int cls, int qos)
+{
+	mosquitto_property *props = NULL;
+	int ret;
+
+	if (it && cls == TC_DATA && !qos) {
+		/* topic aliases for recurring data,
+		 * not for QoS>0, which may be retried on another connection
+		 */
+		if (it->aliasgen != b->gen)
+			it->alias = 0;
+		if (it->alias) {
+			/* established, drop the topic */
+			mosquitto_property_add_int16(&props, MQTT_PROP_TOPIC_ALIAS, it->alias);
+			topic = "";
+		} else if (b->alias_next <= b->alias_max) {
+			it->alias = b->alias_next++;
+			it->aliasgen = b->gen;
+			mosquitto_property_add_int16(&props, MQTT_PROP_TOPIC_ALIAS, it->alias);
 		}
-		my_sum ^= *str;
 	}
-	/* no checksum found, that can't be good */
-	mylog(LOG_WARNING, "incomplete nmea msg '%.10s'", line);
-	return -1;
+	if (expiry && cls >= TC_DATA)
+		mosquitto_property_add_int32(&props, MQTT_PROP_MESSAGE_EXPIRY_INTERVAL, expiry);
+	ret = mosquitto_publish_v5(b->mosq, mid, topic, strlen(payload), payload, qos, retain, props);
+	mosquitto_property_free_all(&props);
+	return ret;
 }
+#endif
 
-static void recvd_gga_gns(const char *msg)
+/* hand one message to libmosquitto
+ * return -1 when it should be retried later
+ */
+static int mqtt_send(struct broker *b, struct topic *it, const char *topic, const char *payload, int retain, int cls)
 {
-	double dval;
-	int ival;
+	int ret, mid, qos;
 
-	/* omit UTC within day */
-	nmea_tok(NULL);
-	/* latt */
-	dval = nmea_deg_to_double(nmea_safe_tok(NULL));
-	/* lat sign */
-	if (*nmea_safe_tok(NULL) == 'S')
-		dval *= -1;
-	publish_topic("lat", "%.7lf", dval);
-	/* lon */
-	dval = nmea_deg_to_double(nmea_safe_tok(NULL));
-	/* lon sign */
-	if (*nmea_safe_tok(NULL) == 'W')
-		dval *= -1;
-	publish_topic("lon", "%.7lf", dval);
-	/* fix */
-	if (!strcasecmp(msg+2, "GGA")) {
-		ival = strtoul(nmea_safe_tok(NULL), NULL, 10);
-		publish_topic("quality", "%s", fromtable(strquality, ival) ?: "");
+	qos = class_qos[cls] >= 0 ? class_qos[cls] : mqtt_qos;
+#ifdef HAVE_MQTT5
+	if (mqtt5)
+		ret = mqtt5_send(b, &mid, it, topic, payload, retain, cls, qos);
+	else
+#endif
+	ret = mosquitto_publish(b->mosq, &mid, topic, strlen(payload), payload, qos, retain);
+	if (ret == MOSQ_ERR_NO_CONN || ret == MOSQ_ERR_CONN_LOST) {
+		mqtt_lost(b, ret);
+		return -1;
+	}
+	if (ret) {
+		/* not recoverable, drop it */
+		mylog(LOG_WARNING, "mosquitto_publish %s: %s", topic, mosquitto_strerror(ret));
+		if (it)
+			/* the alias may not be established */
+			it->alias = 0;
+	} else if (qos) {
+		b->midqos[mid/8 & (sizeof(b->midqos)-1)] |= 1 << (mid % 8);
+		++b->ninflight;
+	}
+	return 0;
+}
+
+static inline int mqtt_can_send(struct broker *b)
+{
+	return b->connected && b->ninflight < maxinflight && !mosquitto_want_write(b->mosq);
+}
+
+static void outq_flush(struct broker *b)
+{
+	while (b->qhead && mqtt_can_send(b)) {
+		if (mqtt_send(b, b->qhead->it, b->qhead->topic, b->qhead->payload, b->qhead->retain, b->qhead->cls) < 0)
+			break;
+		outq_del(b, b->qhead);
+	}
+	if (!b->qhead && b->qdropped) {
+		mylog(LOG_NOTICE, "mqtt %s:%i outbound queue drained, %lu messages were dropped",
+				b->host, b->port, b->qdropped);
+		b->qdropped = 0;
+	}
+}
+
+/* run libmosquitto for up to <msec> while not polling ourselves */
+static void mqtt_service(struct broker *b, int msec)
+{
+	int ret;
+
+	mqtt_reconnect(b);
+	if (mosquitto_socket(b->mosq) < 0 && !b->connected) {
+		/* wait for the next reconnect */
+		poll(NULL, 0, msec);
+		return;
+	}
+	ret = mosquitto_loop(b->mosq, msec, 1);
+	if (ret)
+		mqtt_lost(b, ret);
+	outq_flush(b);
+}
+
+/* idem, for all brokers */
+static void mqtt_service_all(int msec)
+{
+	struct broker *b;
+
+	msec /= nbrokers;
+	for (b = brokers; b < brokers+nbrokers; ++b)
+		mqtt_service(b, msec ?: 1);
+}
+
+static void mqtt_exit(void)
+{
+	struct broker *b;
+
+	for (b = brokers; b < brokers+nbrokers; ++b) {
+		if (b->mosq)
+			mosquitto_disconnect(b->mosq);
+	}
+}
+
+#define cfgprefix "cfg/"
+#define cfgprefixlen 4
+static void geofence_reload(const char *src);
+
+static void my_mqtt_connect(struct mosquitto *mosq, void *dat, int rc)
+{
+	struct broker *b = dat;
+	char *str;
+	int ret;
+
+	if (rc) {
+		mylog(LOG_WARNING, "mqtt %s:%i connection refused (%i)", b->host, b->port, rc);
+		return;
+	}
+	if (b->reconnect_time) {
+		mylog(LOG_NOTICE, "mqtt %s:%i connected, %lu messages queued", b->host, b->port, b->qlen);
+		/* our will may have replaced 'alive' */
+		if (alivepayload[0])
+			outq_add(b, NULL, willtopic, alivepayload, 1, TC_ALIVE);
+	}
+	b->connected = 1;
+	b->reconnect_delay = 0;
+	/* new connection, new aliases */
+	b->gen = ++mqtt_gen;
+	b->alias_next = 1;
+	if (b == curbroker)
+		journal_end_epoch();
+
+	/* (re)subscribe, our session is clean */
+	asprintf(&str, "%s%s#", topicprefix, cfgprefix);
+	ret = mosquitto_subscribe(mosq, NULL, str, mqtt_qos);
+	if (ret)
+		mylog(LOG_WARNING, "mosquitto_subscribe %s: %s", str, mosquitto_strerror(ret));
+	free(str);
+}
+
+#ifdef HAVE_MQTT5
+static void my_mqtt_connect_v5(struct mosquitto *mosq, void *dat, int rc, int flags, const mosquitto_property *props)
+{
+	struct broker *b = dat;
+	uint16_t val = 0;
+
+	/* the broker announces how many aliases we may use */
+	mosquitto_property_read_int16(props, MQTT_PROP_TOPIC_ALIAS_MAXIMUM, &val, false);
+	b->alias_max = val;
+	my_mqtt_connect(mosq, dat, rc);
+}
+#endif
+
+static void my_mqtt_disconnect(struct mosquitto *mosq, void *dat, int rc)
+{
+	struct broker *b = dat;
+
+	if (rc)
+		mqtt_lost(b, MOSQ_ERR_CONN_LOST);
+	else
+		b->connected = 0;
+}
+
+static void my_mqtt_publish(struct mosquitto *mosq, void *dat, int mid)
+{
+	struct broker *b = dat;
+	uint8_t *pbyte = b->midqos + (mid/8 & (sizeof(b->midqos)-1));
+
+	if (*pbyte & (1 << (mid % 8))) {
+		*pbyte &= ~(1 << (mid % 8));
+		if (b->ninflight)
+			--b->ninflight;
+	}
+}
+
+/* publish to <b>, directly or via its queue */
+static void broker_publish(struct broker *b, struct topic *it, const char *topic, const char *payload, int retain, int cls)
+{
+	/* bypass the queue when possible */
+	if (!b->qhead && mqtt_can_send(b) && mqtt_send(b, it, topic, payload, retain, cls) >= 0)
+		return;
+	outq_add(b, it, topic, payload, retain, cls);
+}
+
+/* publish via <outfile>, or to the broker of <topicprefix>
+ * <it> is the cache entry, if any
+ */
+static void publish_msg(struct topic *it, const char *topic, const char *payload, int retain, int cls)
+{
+	struct broker *b;
+
+	if (outfile) {
+		if (outfile_retain) {
+			putc_unlocked(retain ? 'r' : '-', outfile);
+			putc_unlocked(' ', outfile);
+		}
+		fputs_unlocked(topic, outfile);
+		putc_unlocked(' ', outfile);
+		fputs_unlocked(payload, outfile);
+		putc_unlocked('\n', outfile);
+		return;
+	}
+	if (cls == TC_ALIVE && !strcmp(topic, willtopic)) {
+		/* each connection carries our will, so our alive too */
+		strncpy(alivepayload, payload, sizeof(alivepayload)-1);
+		for (b = brokers; b < brokers+nbrokers; ++b)
+			broker_publish(b, it, topic, payload, retain, cls);
+		return;
+	}
+	broker_publish(curbroker, it, topic, payload, retain, cls);
+}
+
+static inline void mypublish(const char *topic, const char *payload, int retain)
+{
+	publish_msg(NULL, topic, payload, retain, topic_class(topic, retain ? FL_RETAIN : 0));
+}
+
+static void my_mqtt_msg(struct mosquitto *mosq, void *dat, const struct mosquitto_message *msg)
+{
+	if (is_self_sync(msg))
+		ready = 1;
+
+	if (seeding && msg->retain && !strncmp(msg->topic, topicprefix, topicprefixlen) &&
+			strncmp(msg->topic+topicprefixlen, cfgprefix, cfgprefixlen)) {
+		seed_topic(msg->topic, (const char *)msg->payload ?: "");
+		return;
+	}
+
+	if (!strncmp(msg->topic, topicprefix, topicprefixlen) &&
+			!strncmp(msg->topic+topicprefixlen, cfgprefix, cfgprefixlen)) {
+		const char *stopic = msg->topic + topicprefixlen + cfgprefixlen;
+
+		if (!strcmp(stopic, "msgs")) {
+			if (!msg->payloadlen)
+				return;
+			int gsv = nmea_use_msg("gsv");
+			merge_nmea_use((char *)msg->payload);
+			mylog(LOG_NOTICE, "nmea msgs changed to '%s'", nmea_use);
+			if (gsv && !nmea_use_msg("gsv"))
+				clear_gsvs();
+
+		} else if (!strcmp(stopic, "always")) {
+			always = strtoul((char *)msg->payload ?: "0", NULL, 0);
+			mylog(LOG_NOTICE, "--%s changed to %u", stopic, always);
+
+		} else if (!strcmp(stopic, "deadtime")) {
+			deadtime = strtod((char *)msg->payload ?: "10", NULL) * 1000;
+			mylog(LOG_NOTICE, "--%s changed to %.3fs", stopic, deadtime / 1e3);
+
+		} else if (!strcmp(stopic, "default")) {
+			if (def_talker_mqtt)
+				free(def_talker_mqtt);
+			def_talker_mqtt = msg->payloadlen ? strdup(msg->payload) : NULL;
+			mylog(LOG_NOTICE, "--%s changed to %s", stopic, def_talker_mqtt ?: def_talker);
+
+		} else if (!strcmp(stopic, "geofence")) {
+			char *str = strndup((char *)msg->payload ?: "", msg->payloadlen);
+
+			geofence_reload(str);
+			free(str);
+		}
+	}
+}
+
+static struct topic *topics, *lasttopic;
+/* the written topics, in order */
+static struct topic *wtopics, *lastwtopic;
+static int ndirty;
+static unsigned long nflushes;
+static int in_data_sentence;
+
+/* debug counters, proof of no heap allocations in steady state */
+static unsigned long ncache_allocs;
+static unsigned long nsentences;
+
+#define TOPIC_SLAB	32
+/* topics of expired gateway sources, for reuse */
+static struct topic *freetopics;
+
+static struct topic *alloc_topic(void)
+{
+	static struct topic *slab;
+	static int slabused = TOPIC_SLAB;
+	struct topic *it;
+
+	if (freetopics) {
+		it = freetopics;
+		freetopics = it->next;
+		memset(it, 0, sizeof(*it));
+		return it;
+	}
+	if (slabused >= TOPIC_SLAB) {
+		slab = calloc(TOPIC_SLAB, sizeof(*slab));
+		if (!slab)
+			mylog(LOG_ERR | LOG_EXIT, "calloc %u topics: %s", TOPIC_SLAB, ESTR(errno));
+		++ncache_allocs;
+		slabused = 0;
+	}
+	return slab + slabused++;
+}
+
+static void mark_written(struct topic *it)
+{
+	if (it->written)
+		return;
+	it->written = 1;
+	it->wnext = NULL;
+	if (!wtopics)
+		wtopics = it;
+	else
+		lastwtopic->wnext = it;
+	lastwtopic = it;
+}
+
+#define ARENA_SIZE	4096
+static char *arena_strdup(const char *str)
+{
+	static char *arena;
+	static size_t arenafree;
+	size_t len = strlen(str)+1;
+	char *result;
+
+	if (len > arenafree) {
+		arenafree = (len > ARENA_SIZE) ? len : ARENA_SIZE;
+		arena = malloc(arenafree);
+		if (!arena)
+			mylog(LOG_ERR | LOG_EXIT, "malloc %lu: %s", (unsigned long)arenafree, ESTR(errno));
+		++ncache_allocs;
+	}
+	result = arena;
+	memcpy(result, str, len);
+	arena += len;
+	arenafree -= len;
+	return result;
+}
+
+/* gateway sources come and go, their topic names must be freed */
+static int heaptopicnames;
+
+static char *topic_strdup(const char *str)
+{
+	char *result;
+
+	if (!heaptopicnames)
+		return arena_strdup(str);
+	result = strdup(str);
+	if (!result)
+		mylog(LOG_ERR | LOG_EXIT, "strdup: %s", ESTR(errno));
+	return result;
+}
+
+/* recycle all topics, the caller has erased them */
+static void free_topics(void)
+{
+	struct topic *it, *next;
+	struct broker *b;
+	struct msg *m;
+
+	for (it = topics; it; it = next) {
+		next = it->next;
+		free(it->heap);
+		if (heaptopicnames)
+			free(it->topic);
+		/* mark as recycled */
+		it->topic = NULL;
+		it->next = freetopics;
+		freetopics = it;
+	}
+	/* queued messages keep their copy of the topic, but lose the alias */
+	for (b = brokers; b < brokers+nbrokers; ++b) {
+		for (m = b->qhead; m; m = m->next) {
+			if (m->it && !m->it->topic)
+				m->it = NULL;
+		}
+	}
+	topics = lasttopic = NULL;
+	wtopics = lastwtopic = NULL;
+}
+
+static void set_payload(struct topic *it, const char *value)
+{
+	int len = strlen(value);
+
+	if (len < TOPIC_INLINE) {
+		it->payload = it->inl;
 	} else {
-		/* gns message */
-		static const char gns_modes[] = "NADPRFEMS";
-		static const char *const talkers[] = {
-			"gp",
-			"gl",
-			"gb",
-			"ga",
-			NULL,
-		};
-		const char *const *talker;
-		const char *chr;
-		const char *tok;
+		if (len >= it->heapsize) {
+			it->heapsize = (len + 64) & ~63;
+			it->heap = realloc(it->heap, it->heapsize);
+			if (!it->heap)
+				mylog(LOG_ERR | LOG_EXIT, "realloc %u: %s", it->heapsize, ESTR(errno));
+			++ncache_allocs;
+		}
+		it->payload = it->heap;
+	}
+	memcpy(it->payload, value, len+1);
+}
 
-		for (tok = nmea_safe_tok(NULL), talker = talkers;
-				*talker && *tok; ++tok, ++talker) {
-			chr = strchr(gns_modes, toupper(*tok));
-			ival = chr ? chr - gns_modes : 0;
-			publish_topicrt(*talker, "mode", 1,
-					"%s", fromtable(strquality, ival) ?: "");
+__attribute__((format(printf,1,2)))
+static const char *mktopic(const char *fmt, ...)
+{
+	va_list va;
+	static char topic[1024];
+
+	va_start(va, fmt);
+	vsnprintf(topic, sizeof(topic), fmt, va);
+	va_end(va);
+	return topic;
+}
+
+
+#define publish_topic(topic, vfmt, ...) publish_topicrt(talker, (topic), FL_RETAIN, (vfmt), ##__VA_ARGS__)
+#define publish_topicr(topic, flags, vfmt, ...) publish_topicrt(talker, (topic), (flags), (vfmt), ##__VA_ARGS__)
+
+static void publish_cache(const char *realtopic, const char *value, int retain);
+__attribute__((format(printf,4,5)))
+static void publish_topicrt(const char *talker, const char *topic, int flags, const char *vfmt, ...)
+{
+	va_list va;
+	static char value[1024];
+	static char realtopic[1024];
+
+	if (vfmt) {
+		va_start(va, vfmt);
+		vsnprintf(value, sizeof(value), vfmt, va);
+		va_end(va);
+	} else
+		value[0] = 0;
+
+	if (!strcmp(value, "nan"))
+		strcpy(value, "");
+
+	if (talker)
+		flags |= FL_DATA;
+	if (talker && ((flags & FL_IGN_DEF_TALKER) || strcmp(talker, def_talker_mqtt ?: def_talker)))
+		snprintf(realtopic, sizeof(realtopic), "%s%s/%s", topicprefix, talker, topic);
+	else
+		snprintf(realtopic, sizeof(realtopic), "%s%s", topicprefix, topic);
+
+	publish_cache(realtopic, value, flags);
+}
+
+static void publish_cache(const char *realtopic, const char *value, int flags)
+{
+	struct topic *it;
+
+	if (!(flags & FL_RETAIN) || (flags & FL_NO_CACHE)) {
+		publish_msg(NULL, realtopic, value, flags & FL_RETAIN, topic_class(realtopic, flags));
+		return;
+	}
+
+	for (it = topics; it; it = it->next) {
+		if (!strcmp(it->topic, realtopic))
+			break;
+	}
+	if (!it) {
+		it = alloc_topic();
+		/* append to linked list */
+		if (!topics) {
+			topics = lasttopic = it;
+		} else {
+			lasttopic->next = it;
+			lasttopic = it;
+		}
+		it->topic = topic_strdup(realtopic);
+		/* save 'retain' only once */
+		it->retain = 1;
+		it->ctrltopic = !in_data_sentence;
+	}
+	mark_written(it);
+	it->seeded = 0;
+	it->cls = topic_class(realtopic, flags);
+	if (strcmp(it->payload ?: "", value)) {
+		set_payload(it, value);
+		++ndirty;
+	}
+}
+
+/* store & forward journal
+ * While the broker is unreachable, one record per epoch is appended
+ * to <journal>, which rotates to <journal>.1 at half its size limit.
+ * After reconnect, the records are published to <prefix>journal
+ * at <journal_rate> per second, only when no live data is queued.
+ * The read position is kept in <journal>.pos, so it survives restarts.
+ * Writes and the position are buffered, and synced to disk
+ * every JOURNAL_SYNC seconds.
+ */
+static const char *const journal_fields[] = {
+	"utc", "lat", "lon", "alt", "speed", "heading", "quality",
+};
+#define NJFIELDS	(sizeof(journal_fields)/sizeof(journal_fields[0]))
+#define JOURNAL_SYNC	10
+
+static char *journal;
+static char *journal_old, *journal_pos;
+static size_t journal_max = 1 << 20;
+static int journal_rate = 10;
+static FILE *jwr, *jrd;
+/* jrd reads <journal>.1 */
+static int jrdseg;
+/* nothing left to replay */
+static int jempty;
+static struct topic *jtopics[NJFIELDS];
+static char jrec[256];
+/* time of day of the pending record */
+static double jtod = NAN;
+static time_t jsynctime;
+static int jdirty;
+static unsigned long jwritten, jreplayed;
+
+static void journal_savepos(void)
+{
+	FILE *fp;
+	char *tmp;
+
+	asprintf(&tmp, "%s.tmp", journal_pos);
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		mylog(LOG_WARNING, "fopen %s: %s", tmp, ESTR(errno));
+		free(tmp);
+		return;
+	}
+	fprintf(fp, "%i %li\n", jrdseg, jrd ? ftell(jrd) : 0L);
+	fflush(fp);
+	/* the new position must be on disk before it replaces the old */
+	fdatasync(fileno(fp));
+	fclose(fp);
+	if (rename(tmp, journal_pos) < 0)
+		mylog(LOG_WARNING, "rename %s: %s", journal_pos, ESTR(errno));
+	free(tmp);
+}
+
+static void journal_sync(void)
+{
+	if (!jwr || !jdirty)
+		return;
+	fflush(jwr);
+	if (fdatasync(fileno(jwr)) < 0)
+		mylog(LOG_WARNING, "fdatasync %s: %s", journal, ESTR(errno));
+	journal_savepos();
+	jdirty = 0;
+}
+
+static void journal_open(void)
+{
+	FILE *fp;
+	long off = 0;
+
+	asprintf(&journal_old, "%s.1", journal);
+	asprintf(&journal_pos, "%s.pos", journal);
+	jwr = fopen(journal, "a");
+	if (!jwr)
+		mylog(LOG_ERR | LOG_EXIT, "fopen %s: %s", journal, ESTR(errno));
+
+	/* resume reading where we stopped */
+	fp = fopen(journal_pos, "r");
+	if (fp) {
+		if (fscanf(fp, "%i %li", &jrdseg, &off) != 2)
+			jrdseg = off = 0;
+		fclose(fp);
+	} else
+		jrdseg = !access(journal_old, F_OK);
+	jrd = fopen(jrdseg ? journal_old : journal, "r");
+	if (jrd && fseek(jrd, off, SEEK_SET) < 0)
+		rewind(jrd);
+}
+
+static void journal_rotate(void)
+{
+	fclose(jwr);
+	if (jrd && jrdseg) {
+		mylog(LOG_WARNING, "journal %s full, dropping the oldest records", journal);
+		fclose(jrd);
+		jrd = NULL;
+	}
+	if (rename(journal, journal_old) < 0)
+		mylog(LOG_WARNING, "rename %s: %s", journal_old, ESTR(errno));
+	/* the reader keeps its offset in the renamed file */
+	jrdseg = 1;
+	jwr = fopen(journal, "a");
+	if (!jwr)
+		mylog(LOG_ERR | LOG_EXIT, "fopen %s: %s", journal, ESTR(errno));
+	jdirty = 1;
+}
+
+static void journal_write(const char *rec)
+{
+	if (ftell(jwr) + strlen(rec) + 1 > journal_max/2)
+		journal_rotate();
+	fputs(rec, jwr);
+	putc('\n', jwr);
+	++jwritten;
+	jempty = 0;
+	jdirty = 1;
+}
+
+/* write the pending epoch */
+static void journal_end_epoch(void)
+{
+	if (jrec[0])
+		journal_write(jrec);
+	jrec[0] = 0;
+	jtod = NAN;
+}
+
+/* collect the epoch, called for each sentence while offline */
+static void journal_epoch(void)
+{
+	struct topic *it;
+	char *str;
+	int j;
+
+	for (j = 0; j < NJFIELDS; ++j) {
+		if (jtopics[j])
+			continue;
+		/* topics are never removed, so remember them */
+		for (it = topics; it; it = it->next) {
+			if (!strncmp(it->topic, topicprefix, topicprefixlen) &&
+					!strcmp(it->topic+topicprefixlen, journal_fields[j])) {
+				jtopics[j] = it;
+				break;
+			}
+		}
+	}
+	if (isnan(epoch_tod))
+		/* no time, no epoch */
+		return;
+	if (epoch_tod != jtod)
+		/* new epoch */
+		journal_end_epoch();
+
+	str = jrec + sprintf(jrec, "%.2f", epoch_tod);
+	for (j = 0; j < NJFIELDS; ++j) {
+		str += snprintf(str, jrec+sizeof(jrec)-str, ",%s",
+				(jtopics[j] ? jtopics[j]->payload : NULL) ?: "");
+		if (str >= jrec+sizeof(jrec))
+			break;
+	}
+	jtod = epoch_tod;
+}
+
+/* read 1 record to replay */
+static int journal_read(char *buf, int size)
+{
+	int len;
+
+	for (;;) {
+		if (!jrd) {
+			jrd = fopen(jrdseg ? journal_old : journal, "r");
+			if (!jrd)
+				return 0;
+		}
+		if (!jrdseg)
+			/* make our recent records visible */
+			fflush(jwr);
+		if (fgets(buf, size, jrd)) {
+			len = strlen(buf);
+			if (len && buf[len-1] == '\n')
+				buf[len-1] = 0;
+			return 1;
+		}
+		/* end of segment */
+		fclose(jrd);
+		jrd = NULL;
+		jdirty = 1;
+		if (jrdseg) {
+			unlink(journal_old);
+			jrdseg = 0;
+			continue;
+		}
+		/* all replayed, restart the journal */
+		if (ftruncate(fileno(jwr), 0) < 0)
+			mylog(LOG_WARNING, "ftruncate %s: %s", journal, ESTR(errno));
+		jempty = 1;
+		return 0;
+	}
+}
+
+/* replay records without starving live data */
+static void journal_drain(void)
+{
+	static time_t sec;
+	static int budget;
+	time_t now;
+	char buf[sizeof(jrec)+1];
+
+	if (!jwr || jempty || curbroker->qhead || !curbroker->connected)
+		return;
+	now = time(NULL);
+	if (now != sec) {
+		sec = now;
+		budget = journal_rate;
+	}
+	for (; budget > 0 && mqtt_can_send(curbroker); --budget) {
+		if (!journal_read(buf, sizeof(buf)))
+			return;
+		mypublish(mktopic("%sjournal", topicprefix), buf, 0);
+		++jreplayed;
+		/* the position advanced */
+		jdirty = 1;
+	}
+}
+
+/* periodic write-back */
+static void journal_tick(void)
+{
+	time_t now;
+
+	if (!jwr)
+		return;
+	now = time(NULL);
+	if (now < jsynctime)
+		return;
+	jsynctime = now + JOURNAL_SYNC;
+	journal_sync();
+}
+
+static void flush_pending_topics(void)
+{
+	struct topic *it;
+
+	for (it = wtopics; it; it = it->wnext) {
+		/* publish cache */
+		if (ndirty || always)
+			publish_msg(it, it->topic, it->payload ?: "", it->retain, it->cls);
+		it->written = 0;
+	}
+	wtopics = lastwtopic = NULL;
+	ndirty = 0;
+	++nflushes;
+	if (jwr && !curbroker->connected)
+		journal_epoch();
+}
+
+/* throughput mode: forget the topics written after <mark>,
+ * as a flush would do for an unchanged sentence
+ */
+static void unmark_written(struct topic *mark)
+{
+	struct topic *it;
+
+	for (it = mark ? mark->wnext : wtopics; it; it = it->wnext)
+		it->written = 0;
+	if (mark)
+		mark->wnext = NULL;
+	else
+		wtopics = NULL;
+	lastwtopic = mark;
+}
+
+/* sentences that carry the epoch's time of day */
+enum {
+	EP_GGA = 1 << 0,
+	EP_RMC = 1 << 1,
+	EP_ZDA = 1 << 2,
+	EP_GLL = 1 << 3,
+	EP_GNS = 1 << 4,
+};
+
+struct input;
+static struct input *curinput;
+static void epoch_track(struct input *in, double tod, int sentence);
+
+/* a sentence with a time of day, before it publishes anything */
+static void epoch_start(double tod, int sentence)
+{
+	if (isnan(tod))
+		return;
+	epoch_track(curinput, tod, sentence);
+	if (throughput && tod != epoch_tod)
+		/* the previous epoch is complete */
+		flush_pending_topics();
+	epoch_tod = tod;
+}
+
+/* UTC time engine
+ * The date of the last ZDA or RMC is kept as the unix time of its day,
+ * so any time of day (GGA, GLL) converts to utc with integer arithmetic.
+ */
+static long days_from_civil(int year, int mon, int mday)
+{
+	long era;
+	int yoe, doy;
+
+	year -= mon <= 2;
+	era = (year >= 0 ? year : year - 399) / 400;
+	yoe = year - era * 400;
+	doy = (153 * (mon + (mon > 2 ? -3 : 9)) + 2) / 5 + mday - 1;
+	return era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+}
+
+static int utc_set_date(int mday, int mon, int year)
+{
+	static int lastdate;
+	static long lastday;
+	int date;
+
+	if (mday < 1 || mday > 31 || mon < 1 || mon > 12 ||
+			year < 1970 || year > 9999)
+		/* no (valid) date */
+		return -1;
+	date = (year * 100 + mon) * 100 + mday;
+	if (date != lastdate) {
+		lastdate = date;
+		lastday = days_from_civil(year, mon, mday) * 86400;
+	}
+	utcday = lastday;
+	return 0;
+}
+
+/* render datetime, in local time, once per second */
+static const char *utc_datetime(time_t tim)
+{
+	static char str[64];
+	static time_t lasttim = -1, quarter = -1;
+	static struct tm tm;
+	static int len;
+	int sec;
+
+	if (tim == lasttim)
+		return str;
+	lasttim = tim;
+	if (tim / 900 != quarter) {
+		/* UTC offsets are multiples of 15 minutes,
+		 * so the local date and hour hold for a whole quarter
+		 */
+		time_t t0;
+
+		quarter = tim / 900;
+		t0 = quarter * 900;
+		localtime_r(&t0, &tm);
+		len = strftime(str, sizeof(str), "%a %d %b %Y %H:", &tm);
+	}
+	sec = tm.tm_min * 60 + tm.tm_sec + tim % 900;
+	str[len+0] = '0' + sec / 600;
+	str[len+1] = '0' + sec / 60 % 10;
+	str[len+2] = ':';
+	str[len+3] = '0' + sec % 60 / 10;
+	str[len+4] = '0' + sec % 10;
+	str[len+5] = 0;
+	return str;
+}
+
+static void publish_utc_tod(double tod)
+{
+	time_t tim;
+	long val;
+	int cs;
+
+	if (utcday < 0)
+		/* no date (yet) */
+		return;
+	if (isnan(tod)) {
+		val = cs = 0;
+	} else {
+		val = tod;
+		/* centiseconds */
+		cs = (tod - val) * 100 + 0.5;
+		if (cs >= 100) {
+			++val;
+			cs -= 100;
+		}
+	}
+	utctod = tod;
+	tim = utcday + val;
+	if (!cs)
+		publish_topic("utc", "%ld", (long)tim);
+	else if (cs % 10)
+		publish_topic("utc", "%ld.%02i", (long)tim, cs);
+	else
+		publish_topic("utc", "%ld.%i", (long)tim, cs / 10);
+	lastfix.utc = tim + cs / 100.0;
+	fixdirty |= FIX_POS;
+	publish_topic("datetime", "%s", utc_datetime(tim));
+}
+
+/* ZDA & RMC: time of day with date */
+static void publish_utc(double tod, int mday, int mon, int year)
+{
+	if (utc_set_date(mday, mon, year) < 0)
+		return;
+	publish_utc_tod(tod);
+}
+
+/* GGA, GNS & GLL: time of day, on the last known date */
+static void publish_utc_nodate(double tod)
+{
+	if (utcday < 0 || isnan(tod))
+		return;
+	if (!isnan(utctod) && tod < utctod - 43200)
+		/* passed midnight, before the next date arrives */
+		utcday += 86400;
+	publish_utc_tod(tod);
+}
+
+static void erase_topics(int clrctrl)
+{
+	struct topic *it;
+
+	for (it = topics; it; it = it->next) {
+		if (it->ctrltopic && !clrctrl)
+			continue;
+		if (!it->payload)
+			/* nothting to erase */
+			continue;
+		/* clear cached value, and mark as dirty */
+		it->payload = NULL;
+		mark_written(it);
+		++ndirty;
+	}
+	flush_pending_topics();
+}
+
+/* inputs
+ * With redundant receivers, all inputs are parsed,
+ * but only the selected input publishes.
+ * The others only keep track of their fix, to select the best one.
+ */
+/* epoch statistics, to tell receiver drops from host overruns */
+struct epochs {
+	/* time of day of the latest epoch, and its sentences */
+	double tod;
+	int seen;
+	/* learned output period in msec, 0 while unknown */
+	int period;
+	int cand, ncand;
+	unsigned long n, missed, repeated, gsvgaps;
+	/* system clock - GNSS time, over the last stats interval */
+	double clk, clkmin, clkmax;
+	int nclk;
+};
+
+struct input {
+	const char *name;
+	int fd;
+	int deadtfd;
+	int alive;
+	int eof;
+	/* not pollable, always readable */
+	int regular;
+	/* receive buffer */
+	char *buf;
+	size_t buflen, bufsize;
+	/* fix of the last GGA/GNS */
+	int reported;
+	int rank;
+	int satuse;
+	double hdop;
+	/* sentences with a bad checksum */
+	unsigned long nbad;
+	struct epochs ep;
+};
+
+static struct input definput = { .name = "<stdin>", };
+static struct input *inputs = &definput;
+static int ninputs = 1;
+/* input being parsed, input that publishes */
+static struct input *curinput = &definput;
+static struct input *selected = &definput;
+
+enum {
+	SEL_ALIVE,
+	SEL_FIX,
+	SEL_BEST,
+};
+static const char *const strselect[] = {
+	[SEL_ALIVE] = "alive",
+	[SEL_FIX] = "fix",
+	[SEL_BEST] = "best",
+};
+static int select_policy = SEL_BEST;
+/* score margin to leave a good input */
+#define SEL_HYSTERESIS	50
+/* a new fix asks for a selection, after its sentence */
+static int reselect;
+/* until then, wait for the primary's 1st fix */
+static time_t selgrace;
+
+static int input_score(const struct input *in)
+{
+	if (!in->alive)
+		return -1;
+	if (select_policy == SEL_ALIVE || in->rank <= 0)
+		return 0;
+	if (select_policy == SEL_FIX)
+		return 1;
+	/* quality first, then satellites & hdop */
+	return in->rank*1000 + in->satuse*10 - (isnan(in->hdop) ? 100 : (int)(in->hdop*10));
+}
+
+static void input_select(void)
+{
+	struct input *in, *best = selected;
+	int score, bestscore = input_score(selected);
+
+	reselect = 0;
+	if (selected == inputs && !selected->reported && selgrace && time(NULL) < selgrace)
+		/* give the primary a chance */
+		return;
+	for (in = inputs; in < inputs+ninputs; ++in) {
+		if (in == best)
+			continue;
+		score = input_score(in);
+		if (score < 0)
+			continue;
+		if (score > bestscore + (bestscore >= 1000 ? SEL_HYSTERESIS : 0) ||
+				/* prefer the primary input */
+				(in < best && score >= bestscore)) {
+			best = in;
+			bestscore = score;
+		}
+	}
+	if (best == selected)
+		return;
+	mylog(LOG_NOTICE, "switch from %s to %s", selected->name, best->name);
+	publish_topicrt(NULL, "switch", 0, "%s %s", selected->name, best->name);
+	publish_topicrt(NULL, "src", FL_RETAIN, "%s", best->name);
+	flush_pending_topics();
+	selected = best;
+}
+
+/* learn the output period from the time of day,
+ * and count the epochs that got lost or repeated
+ */
+#define EP_CONFIRM	3
+/* a slower rate must last longer, missed epochs look alike */
+#define EP_CONFIRM_SLOWER	10
+static void epoch_track(struct input *in, double tod, int sentence)
+{
+	struct epochs *ep = &in->ep;
+	struct timespec ts;
+	double clk;
+	long dt;
+
+	if (ep->n && tod == ep->tod) {
+		if (ep->seen & sentence)
+			/* the same sentence twice in 1 epoch */
+			++ep->repeated;
+		ep->seen |= sentence;
+		return;
+	}
+	if (ep->n) {
+		dt = (tod - ep->tod) * 1000 + (tod >= ep->tod ? 0.5 : -0.5);
+		if (dt < -43200000)
+			/* midnight */
+			dt += 86400000;
+		if (dt <= 0) {
+			/* an older epoch, out of order */
+			++ep->repeated;
+			return;
+		}
+		if (dt != ep->cand) {
+			ep->cand = dt;
+			ep->ncand = 0;
+		}
+		if (++ep->ncand >= ((ep->period && dt > ep->period) ? EP_CONFIRM_SLOWER : EP_CONFIRM))
+			ep->period = dt;
+		if (ep->period && dt > ep->period * 3 / 2)
+			ep->missed += (dt + ep->period / 2) / ep->period - 1;
+	}
+	++ep->n;
+	ep->tod = tod;
+	ep->seen = sentence;
+
+	if (in->regular || utcday < 0)
+		/* replay, or no date */
+		return;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	clk = ts.tv_sec - utcday + ts.tv_nsec * 1e-9 - tod;
+	if (!isnan(utctod) && tod < utctod - 43200)
+		/* midnight, the date follows */
+		clk -= 86400;
+	if (!ep->nclk || clk < ep->clkmin)
+		ep->clkmin = clk;
+	if (!ep->nclk || clk > ep->clkmax)
+		ep->clkmax = clk;
+	ep->clk = clk;
+	++ep->nclk;
+}
+
+/* log & publish the epoch statistics of an input,
+ * under <PREFIX>stat/, or <PREFIX>stat/<SUB>/
+ */
+static void epoch_stats(struct input *in, const char *sub, int dolog)
+{
+	struct epochs *ep = &in->ep;
+	struct serial_icounter_struct icount;
+	char clkstr[64] = "", uartstr[128] = "", stat[64];
+	int uart;
+
+	uart = !in->regular && in->fd >= 0 && !ioctl(in->fd, TIOCGICOUNT, &icount);
+	if (ep->nclk)
+		snprintf(clkstr, sizeof(clkstr), ", clock %+.3lfs (%+.3lf .. %+.3lf)",
+				ep->clk, ep->clkmin, ep->clkmax);
+	if (uart)
+		snprintf(uartstr, sizeof(uartstr), ", uart %i overruns, %i buffer overruns, %i framing errors",
+				icount.overrun, icount.buf_overrun, icount.frame);
+	if (dolog)
+		mylog(LOG_NOTICE, "%s %lu epochs every %ims, %lu missed, %lu repeated, %lu gsv gaps, %lu bad sentences%s%s",
+				in->name, ep->n, ep->period, ep->missed, ep->repeated,
+				ep->gsvgaps, in->nbad, clkstr, uartstr);
+
+	snprintf(stat, sizeof(stat), sub ? "stat/%s/" : "stat/%s", sub ?: "");
+	publish_topicrt(NULL, mktopic("%sepochs", stat), 0, "%lu", ep->n);
+	publish_topicrt(NULL, mktopic("%speriod", stat), 0, "%.3lf", ep->period / 1e3);
+	publish_topicrt(NULL, mktopic("%smissed", stat), 0, "%lu", ep->missed);
+	publish_topicrt(NULL, mktopic("%srepeated", stat), 0, "%lu", ep->repeated);
+	publish_topicrt(NULL, mktopic("%sgsvgaps", stat), 0, "%lu", ep->gsvgaps);
+	publish_topicrt(NULL, mktopic("%sbad", stat), 0, "%lu", in->nbad);
+	if (ep->nclk)
+		publish_topicrt(NULL, mktopic("%sclock", stat), 0, "%.3lf %.3lf %.3lf",
+				ep->clk, ep->clkmin, ep->clkmax);
+	if (uart) {
+		publish_topicrt(NULL, mktopic("%suart/overrun", stat), 0, "%i", icount.overrun);
+		publish_topicrt(NULL, mktopic("%suart/bufoverrun", stat), 0, "%i", icount.buf_overrun);
+		publish_topicrt(NULL, mktopic("%suart/frame", stat), 0, "%i", icount.frame);
+	}
+	/* min & max per interval */
+	ep->nclk = 0;
+}
+
+static void input_metrics(const struct nmea_gga *gga)
+{
+	const char *str;
+	int rank = 0, r;
+
+	if (gga->quality >= 0) {
+		/* gps, dgps, pps, rtk, float-rtk */
+		static const int ranks[] = { 0, 1, 2, 2, 4, 3, };
+
+		if (gga->quality < sizeof(ranks)/sizeof(ranks[0]))
+			rank = ranks[gga->quality];
+	} else {
+		/* best mode of all talkers */
+		for (str = gga->modes ?: ""; *str; ++str) {
+			switch (*str) {
+			case 'A':
+				r = 1;
+				break;
+			case 'D':
+			case 'P':
+				r = 2;
+				break;
+			case 'F':
+				r = 3;
+				break;
+			case 'R':
+				r = 4;
+				break;
+			default:
+				r = 0;
+				break;
+			}
+			if (r > rank)
+				rank = r;
+		}
+	}
+	curinput->reported = 1;
+	curinput->rank = rank;
+	curinput->satuse = gga->satuse;
+	curinput->hdop = gga->hdop;
+	if (ninputs > 1)
+		reselect = 1;
+}
+
+/* nmea parser */
+static int nmea_is_valid_sentence(char *line)
+{
+	int ret;
+
+	ret = nmea_check_sentence(line);
+	if (ret < 0)
+		mylog(LOG_WARNING, "%s '%.10s'", nmea_strerror(ret), line);
+	return ret;
+}
+
+/* online track simplification (sleeve)
+ * Positions are skipped while a line from the last vertex passes
+ * within <track_tol> of all of them: each position narrows the cone
+ * of directions from the vertex.
+ * When the cone closes, the previous position becomes the next vertex.
+ */
+#define TRACK_WINDOW	1200
+/* meters per degree of latitude */
+#define M_PER_DEG	111319.49
+struct track {
+	/* the last vertex, 0 positions when no track */
+	double lat0, lon0;
+	/* meters per degree of longitude at the vertex */
+	double mlon;
+	int n;
+	/* the cone, relative to dir */
+	int cone;
+	double dir, amin, amax;
+	/* the farthest position from the vertex */
+	double dmax, xmax, ymax;
+	/* the previous position */
+	double lat, lon, utc;
+};
+static struct track track;
+
+static void track_publish(double lat, double lon, double utc)
+{
+	if (isnan(utc))
+		publish_topicrt(NULL, "track", 0, "%.7lf %.7lf", lat, lon);
+	else
+		publish_topicrt(NULL, "track", 0, "%.7lf %.7lf %.2lf", lat, lon, utc);
+}
+
+static void track_vertex(double lat, double lon, double utc)
+{
+	track_publish(lat, lon, utc);
+	track.lat0 = track.lat = lat;
+	track.lon0 = track.lon = lon;
+	track.utc = utc;
+	track.mlon = M_PER_DEG * cos(lat * M_PI / 180);
+	track.n = 1;
+	track.cone = 0;
+	track.dmax = 0;
+}
+
+static void track_add(double lat, double lon, double utc)
+{
+	double x, y, d, a, h;
+
+	if (!track.n) {
+		/* start */
+		track_vertex(lat, lon, utc);
+		return;
+	}
+	x = lon - track.lon0;
+	if (x > 180)
+		x -= 360;
+	else if (x < -180)
+		x += 360;
+	x *= track.mlon;
+	y = (lat - track.lat0) * M_PER_DEG;
+	d = hypot(x, y);
+	if (d > track_tol) {
+		a = atan2(y, x);
+		h = asin(track_tol / d);
+		if (!track.cone) {
+			track.cone = 1;
+			track.dir = a;
+			track.amin = -h;
+			track.amax = h;
+		} else {
+			a -= track.dir;
+			if (a > M_PI)
+				a -= 2*M_PI;
+			else if (a < -M_PI)
+				a += 2*M_PI;
+			/* the line towards this position must pass all previous ones */
+			if (a < track.amin || a > track.amax || track.n >= TRACK_WINDOW ||
+					/* turning back */
+					(d < track.dmax && hypot(x - track.xmax, y - track.ymax) > track_tol)) {
+				/* the previous position is a vertex,
+				 * restart from there
+				 */
+				track_vertex(track.lat, track.lon, track.utc);
+				track_add(lat, lon, utc);
+				return;
+			}
+			track.amin = fmax(track.amin, a - h);
+			track.amax = fmin(track.amax, a + h);
+		}
+	}
+	if (d > track.dmax) {
+		track.dmax = d;
+		track.xmax = x;
+		track.ymax = y;
+	}
+	track.lat = lat;
+	track.lon = lon;
+	track.utc = utc;
+	++track.n;
+}
+
+/* fix lost: finish the track */
+static void track_end(void)
+{
+	if (track.n > 1)
+		track_publish(track.lat, track.lon, track.utc);
+	track.n = 0;
+}
+
+/* geofences
+ * A GeoJSON set of (Multi)Polygon features, indexed in a uniform grid
+ * of cells that list the fences whose bounding box overlaps the cell.
+ * A fix only tests the fences of its cell,
+ * and publishes <PREFIX>geofence/<NAME> 'enter', 'exit' or 'dwell'.
+ */
+#define GEO_MAXCELLS	(1 << 20)
+struct fence {
+	char *name;
+	/* its rings, even-odd over all, for holes & multipolygons */
+	int ring, nrings;
+	double lonmin, lonmax, latmin, latmax;
+};
+
+struct fenceset {
+	struct fence *fences;
+	int nfences, sfences;
+	/* lon,lat */
+	double (*pts)[2];
+	int npts, spts;
+	/* start of each ring in pts, and the end */
+	int *rings;
+	int nrings, srings;
+	/* grid */
+	double lon0, lat0, cellw, cellh;
+	int nx, ny;
+	int *cellstart, *cellfences;
+};
+
+/* a fence that a source is in */
+struct infence {
+	int idx;
+	/* time of day of entry */
+	double since;
+	int dwelled;
+	int seen;
+};
+
+struct geostate {
+	struct infence *in;
+	int nin, sin;
+	/* the set of in[].idx */
+	struct fenceset *set;
+	double tod;
+};
+
+static struct fenceset *fences;
+static char *geofile;
+static double geodwell = 60;
+static struct geostate geo = { .tod = NAN, };
+static unsigned long geoevents;
+
+/* minimal JSON walker for GeoJSON, in place & without allocations */
+static const char *js_ws(const char *p)
+{
+	while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+		++p;
+	return p;
+}
+
+/* skip a value, NULL on error */
+static const char *js_skip(const char *p)
+{
+	int depth = 0;
+	const char *tok;
+
+	p = js_ws(p);
+	do {
+		switch (*p) {
+		case '"':
+			for (++p; *p != '"'; ++p) {
+				if (!*p || (*p == '\\' && !*++p))
+					return NULL;
+			}
+			++p;
+			break;
+		case '{':
+		case '[':
+			++depth;
+			++p;
+			break;
+		case '}':
+		case ']':
+			if (--depth < 0)
+				return NULL;
+			++p;
+			break;
+		case ',':
+		case ':':
+			if (!depth)
+				return NULL;
+			++p;
+			break;
+		case ' ':
+		case '\t':
+		case '\r':
+		case '\n':
+			++p;
+			break;
+		default:
+			/* number, true, false, null */
+			for (tok = p; isalnum(*p) || *p == '-' || *p == '+' || *p == '.'; ++p);
+			if (p == tok)
+				return NULL;
+			break;
+		}
+	} while (depth);
+	return p;
+}
+
+/* the value of member <key> of an object */
+static const char *js_member(const char *p, const char *key)
+{
+	const char *k;
+	int match;
+
+	p = js_ws(p);
+	if (*p != '{')
+		return NULL;
+	for (p = js_ws(p+1); *p == '"'; ) {
+		k = p+1;
+		p = js_skip(p);
+		if (!p)
+			return NULL;
+		match = p-1-k == strlen(key) && !strncmp(k, key, p-1-k);
+		p = js_ws(p);
+		if (*p != ':')
+			return NULL;
+		p = js_ws(p+1);
+		if (match)
+			return p;
+		p = js_skip(p);
+		if (!p)
+			return NULL;
+		p = js_ws(p);
+		if (*p == ',')
+			p = js_ws(p+1);
+	}
+	return NULL;
+}
+
+/* the first element of an array */
+static const char *js_first(const char *p)
+{
+	p = js_ws(p ?: "");
+	if (*p != '[')
+		return NULL;
+	p = js_ws(p+1);
+	return (*p == ']') ? NULL : p;
+}
+
+/* the element after <p> */
+static const char *js_next(const char *p)
+{
+	p = js_skip(p);
+	if (!p)
+		return NULL;
+	p = js_ws(p);
+	return (*p == ',') ? js_ws(p+1) : NULL;
+}
+
+/* a string or number as text */
+static void js_str(const char *p, char *buf, size_t size)
+{
+	const char *end;
+	size_t len = 0;
+
+	p = js_ws(p ?: "");
+	if (*p != '"') {
+		end = js_skip(p);
+		if (!end || *p == '{' || *p == '[')
+			end = p;
+		len = end - p < size ? end - p : size-1;
+		memcpy(buf, p, len);
+	} else {
+		for (++p; *p && *p != '"' && len < size-1; ++p) {
+			if (*p == '\\' && p[1])
+				++p;
+			buf[len++] = *p;
+		}
+	}
+	buf[len] = 0;
+}
+
+static void fenceset_free(struct fenceset *fs)
+{
+	int j;
+
+	if (!fs)
+		return;
+	for (j = 0; j < fs->nfences; ++j)
+		free(fs->fences[j].name);
+	free(fs->fences);
+	free(fs->pts);
+	free(fs->rings);
+	free(fs->cellstart);
+	free(fs->cellfences);
+	free(fs);
+}
+
+#define GROW(arr, n, size) do { \
+	if ((n) >= (size)) { \
+		(size) = (size) ? (size)*2 : 64; \
+		(arr) = realloc((arr), sizeof(*(arr))*(size)); \
+		if (!(arr)) \
+			mylog(LOG_ERR | LOG_EXIT, "realloc %s: %s", #arr, ESTR(errno)); \
+	} } while (0)
+
+/* add the rings of 1 polygon, 0 on success */
+static int fence_add_polygon(struct fenceset *fs, struct fence *f, const char *poly)
+{
+	const char *ring, *pos, *val;
+	double lon, lat;
+
+	for (ring = js_first(poly); ring; ring = js_next(ring)) {
+		GROW(fs->rings, fs->nrings+1, fs->srings);
+		fs->rings[fs->nrings++] = fs->npts;
+		++f->nrings;
+		for (pos = js_first(ring); pos; pos = js_next(pos)) {
+			val = js_first(pos);
+			if (!val)
+				return -1;
+			lon = strtod(val, NULL);
+			val = js_next(val);
+			if (!val)
+				return -1;
+			lat = strtod(val, NULL);
+			/* strtod takes nan & inf too */
+			if (!(lon >= -180 && lon <= 180 && lat >= -90 && lat <= 90))
+				return -1;
+			GROW(fs->pts, fs->npts, fs->spts);
+			fs->pts[fs->npts][0] = lon;
+			fs->pts[fs->npts][1] = lat;
+			++fs->npts;
+			if (lon < f->lonmin)
+				f->lonmin = lon;
+			if (lon > f->lonmax)
+				f->lonmax = lon;
+			if (lat < f->latmin)
+				f->latmin = lat;
+			if (lat > f->latmax)
+				f->latmax = lat;
+		}
+		if (fs->npts - fs->rings[fs->nrings-1] < 3)
+			/* no area */
+			return -1;
+		fs->rings[fs->nrings] = fs->npts;
+	}
+	return 0;
+}
+
+/* the far edge belongs to the last cell */
+static inline int geo_cell(double pos, int n)
+{
+	return (pos >= n) ? n-1 : (int)pos;
+}
+
+static void fenceset_index(struct fenceset *fs)
+{
+	double lon1 = -INFINITY, lat1 = -INFINITY;
+	struct fence *f;
+	int ncells, x, y, x0, x1, y0, y1, j;
+
+	fs->lon0 = fs->lat0 = INFINITY;
+	for (f = fs->fences; f < fs->fences+fs->nfences; ++f) {
+		fs->lon0 = fmin(fs->lon0, f->lonmin);
+		fs->lat0 = fmin(fs->lat0, f->latmin);
+		lon1 = fmax(lon1, f->lonmax);
+		lat1 = fmax(lat1, f->latmax);
+	}
+	/* about 4 cells per fence */
+	ncells = fs->nfences*4;
+	if (ncells > GEO_MAXCELLS)
+		ncells = GEO_MAXCELLS;
+	fs->nx = fs->ny = ceil(sqrt(ncells));
+	fs->cellw = fmax(lon1 - fs->lon0, 1e-9) / fs->nx;
+	fs->cellh = fmax(lat1 - fs->lat0, 1e-9) / fs->ny;
+	ncells = fs->nx * fs->ny;
+
+	/* count, then fill the fences per cell */
+	fs->cellstart = calloc(ncells+1, sizeof(*fs->cellstart));
+	if (!fs->cellstart)
+		mylog(LOG_ERR | LOG_EXIT, "calloc %i cells: %s", ncells, ESTR(errno));
+	for (j = 0; j < 2; ++j) {
+		for (f = fs->fences; f < fs->fences+fs->nfences; ++f) {
+			x0 = geo_cell((f->lonmin - fs->lon0) / fs->cellw, fs->nx);
+			x1 = geo_cell((f->lonmax - fs->lon0) / fs->cellw, fs->nx);
+			y0 = geo_cell((f->latmin - fs->lat0) / fs->cellh, fs->ny);
+			y1 = geo_cell((f->latmax - fs->lat0) / fs->cellh, fs->ny);
+			for (y = y0; y <= y1; ++y) {
+				for (x = x0; x <= x1; ++x) {
+					if (!j)
+						++fs->cellstart[y*fs->nx + x + 1];
+					else
+						fs->cellfences[fs->cellstart[y*fs->nx + x]++] = f - fs->fences;
+				}
+			}
+		}
+		if (!j) {
+			for (x = 0; x < ncells; ++x)
+				fs->cellstart[x+1] += fs->cellstart[x];
+			fs->cellfences = malloc(sizeof(*fs->cellfences) * (fs->cellstart[ncells] ?: 1));
+			if (!fs->cellfences)
+				mylog(LOG_ERR | LOG_EXIT, "malloc cell fences: %s", ESTR(errno));
+		}
+	}
+	/* filling moved each start to the next cell */
+	memmove(fs->cellstart+1, fs->cellstart, ncells*sizeof(*fs->cellstart));
+	fs->cellstart[0] = 0;
+}
+
+/* parse a GeoJSON FeatureCollection, NULL on error */
+static struct fenceset *fenceset_parse(const char *json, const char *what)
+{
+	struct fenceset *fs;
+	struct fence *f;
+	const char *feat, *geom, *coords, *poly, *val;
+	char type[32], name[256];
+	int multi;
+	char *str;
+
+	fs = calloc(1, sizeof(*fs));
+	if (!fs)
+		mylog(LOG_ERR | LOG_EXIT, "calloc fences: %s", ESTR(errno));
+	for (feat = js_first(js_member(json, "features")); feat; feat = js_next(feat)) {
+		geom = js_member(feat, "geometry");
+		js_str(js_member(geom ?: "", "type"), type, sizeof(type));
+		multi = !strcmp(type, "MultiPolygon");
+		if (!multi && strcmp(type, "Polygon"))
+			/* no area */
+			continue;
+		js_str(js_member(js_member(feat, "properties") ?: "", "name"), name, sizeof(name));
+		if (!*name)
+			js_str(js_member(feat, "id"), name, sizeof(name));
+		if (!*name)
+			sprintf(name, "%i", fs->nfences);
+		/* no wildcards in topics */
+		for (str = name; *str; ++str) {
+			if (*str == '+' || *str == '#')
+				*str = '_';
+		}
+
+		GROW(fs->fences, fs->nfences, fs->sfences);
+		f = fs->fences + fs->nfences++;
+		f->name = strdup(name);
+		f->ring = fs->nrings;
+		f->nrings = 0;
+		f->lonmin = f->latmin = INFINITY;
+		f->lonmax = f->latmax = -INFINITY;
+		coords = js_member(geom, "coordinates");
+		if (multi) {
+			for (poly = js_first(coords); poly; poly = js_next(poly)) {
+				if (fence_add_polygon(fs, f, poly) < 0)
+					goto fail;
+			}
+		} else if (fence_add_polygon(fs, f, coords) < 0)
+			goto fail;
+		if (!f->nrings)
+			goto fail;
+	}
+	val = js_member(json, "type");
+	js_str(val, type, sizeof(type));
+	if (strcmp(type, "FeatureCollection")) {
+		mylog(LOG_WARNING, "%s: no GeoJSON FeatureCollection", what);
+		fenceset_free(fs);
+		return NULL;
+	}
+	fenceset_index(fs);
+	return fs;
+fail:
+	mylog(LOG_WARNING, "%s: bad polygon in '%s'", what, name);
+	fenceset_free(fs);
+	return NULL;
+}
+
+static struct fenceset *fenceset_load(const char *filename)
+{
+	struct fenceset *fs;
+	FILE *fp;
+	char *dat = NULL;
+	size_t size = 0;
+
+	fp = fopen(filename, "r");
+	if (!fp) {
+		mylog(LOG_WARNING, "fopen %s: %s", filename, ESTR(errno));
+		return NULL;
+	}
+	if (getdelim(&dat, &size, 0, fp) < 0) {
+		mylog(LOG_WARNING, "read %s: %s", filename, ESTR(errno));
+		fclose(fp);
+		free(dat);
+		return NULL;
+	}
+	fclose(fp);
+	fs = fenceset_parse(dat, filename);
+	free(dat);
+	return fs;
+}
+
+static int fence_contains(const struct fenceset *fs, const struct fence *f, double lon, double lat)
+{
+	const double (*p)[2];
+	int r, j, k, n, in = 0;
+
+	for (r = f->ring; r < f->ring + f->nrings; ++r) {
+		p = (const double (*)[2])fs->pts + fs->rings[r];
+		n = fs->rings[r+1] - fs->rings[r];
+		for (j = 0, k = n-1; j < n; k = j++) {
+			if ((p[j][1] > lat) != (p[k][1] > lat) &&
+					lon < (p[k][0] - p[j][0]) * (lat - p[j][1]) / (p[k][1] - p[j][1]) + p[j][0])
+				in = !in;
+		}
+	}
+	return in;
+}
+
+static void geofence_event(const char *name, const char *event)
+{
+	publish_topicrt(NULL, mktopic("geofence/%s", name), 0, "%s", event);
+	++geoevents;
+}
+
+/* map the current source to a new set, by name */
+static void geofence_rebase(struct fenceset *fs)
+{
+	struct infence *in;
+	const char *name;
+	int j;
+
+	if (geo.set == fs)
+		return;
+	for (in = geo.in; in < geo.in+geo.nin; ) {
+		name = geo.set->fences[in->idx].name;
+		for (j = 0; fs && j < fs->nfences; ++j) {
+			if (!strcmp(fs->fences[j].name, name))
+				break;
+		}
+		if (!fs || j >= fs->nfences) {
+			/* the fence is gone */
+			geofence_event(name, "exit");
+			*in = geo.in[--geo.nin];
+			continue;
+		}
+		in->idx = j;
+		++in;
+	}
+	geo.set = fs;
+}
+
+static void geofence_fix(double lat, double lon, double tod)
+{
+	const struct fenceset *fs = fences;
+	const struct fence *f;
+	struct infence *in;
+	int x, y, j, k;
+	double dt;
+
+	if (!fs || isnan(lat) || isnan(lon) || tod == geo.tod)
+		return;
+	geo.tod = tod;
+	geofence_rebase(fences);
+	for (in = geo.in; in < geo.in+geo.nin; ++in)
+		in->seen = 0;
+	if (lon >= fs->lon0 && lat >= fs->lat0) {
+		x = geo_cell((lon - fs->lon0) / fs->cellw, fs->nx);
+		y = geo_cell((lat - fs->lat0) / fs->cellh, fs->ny);
+		for (j = fs->cellstart[y*fs->nx + x]; j < fs->cellstart[y*fs->nx + x + 1]; ++j) {
+			f = fs->fences + fs->cellfences[j];
+			if (lon < f->lonmin || lon > f->lonmax || lat < f->latmin || lat > f->latmax ||
+					!fence_contains(fs, f, lon, lat))
+				continue;
+			for (k = 0; k < geo.nin; ++k) {
+				if (geo.in[k].idx == fs->cellfences[j])
+					break;
+			}
+			if (k >= geo.nin) {
+				GROW(geo.in, geo.nin, geo.sin);
+				geo.in[k] = (struct infence){ .idx = fs->cellfences[j], .since = tod, };
+				++geo.nin;
+				geofence_event(f->name, "enter");
+			}
+			geo.in[k].seen = 1;
+		}
+	}
+	for (in = geo.in; in < geo.in+geo.nin; ) {
+		if (!in->seen) {
+			geofence_event(fs->fences[in->idx].name, "exit");
+			*in = geo.in[--geo.nin];
+			continue;
+		}
+		dt = tod - in->since;
+		if (dt < 0)
+			/* midnight */
+			dt += 86400;
+		if (geodwell > 0 && !in->dwelled && dt >= geodwell) {
+			geofence_event(fs->fences[in->idx].name, "dwell");
+			in->dwelled = 1;
+		}
+		++in;
+	}
+}
+
+static void gw_geofence_rebase(struct fenceset *fs);
+
+/* load FILE, or GeoJSON text */
+static void geofence_reload(const char *src)
+{
+	struct fenceset *fs, *old = fences;
+
+	if (*src == '{')
+		fs = fenceset_parse(src, "cfg/geofence");
+	else {
+		if (*src) {
+			free(geofile);
+			geofile = strdup(src);
+		}
+		fs = fenceset_load(geofile);
+	}
+	if (!fs)
+		/* keep the current set */
+		return;
+	fences = fs;
+	geofence_rebase(fs);
+	gw_geofence_rebase(fs);
+	fenceset_free(old);
+	mylog(LOG_NOTICE, "geofence %i fences, %i vertices, %ix%i grid",
+			fs->nfences, fs->npts, fs->nx, fs->ny);
+}
+
+/* derived kinematics
+ * ECEF, UTM, and ENU relative to <origin>, on WGS84.
+ * The trig of the origin is done once.
+ */
+#define WGS84_A		6378137.0
+#define WGS84_F		(1/298.257223563)
+#define WGS84_E2	(WGS84_F*(2-WGS84_F))
+static int derive_ecef, derive_utm;
+static int have_origin;
+static double origin[3];
+/* sin & cos of the origin's lat & lon, and its ECEF */
+static double olat_s, olat_c, olon_s, olon_c;
+static double oecef[3];
+
+static void geodetic_to_ecef(double lat, double lon, double h, double *ecef)
+{
+	double slat = sin(lat * M_PI / 180), clat = cos(lat * M_PI / 180);
+	double n = WGS84_A / sqrt(1 - WGS84_E2 * slat * slat);
+
+	ecef[0] = (n + h) * clat * cos(lon * M_PI / 180);
+	ecef[1] = (n + h) * clat * sin(lon * M_PI / 180);
+	ecef[2] = (n * (1 - WGS84_E2) + h) * slat;
+}
+
+static void origin_init(void)
+{
+	olat_s = sin(origin[0] * M_PI / 180);
+	olat_c = cos(origin[0] * M_PI / 180);
+	olon_s = sin(origin[1] * M_PI / 180);
+	olon_c = cos(origin[1] * M_PI / 180);
+	geodetic_to_ecef(origin[0], origin[1], origin[2], oecef);
+}
+
+static void ecef_to_enu(const double *ecef, double *enu)
+{
+	double dx = ecef[0] - oecef[0], dy = ecef[1] - oecef[1], dz = ecef[2] - oecef[2];
+
+	enu[0] = -olon_s * dx + olon_c * dy;
+	enu[1] = -olat_s * olon_c * dx - olat_s * olon_s * dy + olat_c * dz;
+	enu[2] = olat_c * olon_c * dx + olat_c * olon_s * dy + olat_s * dz;
+}
+
+/* UTM by the Krüger series, to n^3, mm accurate within a zone.
+ * Returns the zone, 0 outside 80S..84N (UPS)
+ */
+static int geodetic_to_utm(double lat, double lon, char *band, double *east, double *north)
+{
+	static const char bands[] = "CDEFGHJKLMNPQRSTUVWXX";
+	static double n, a, alpha[3], c;
+	double t, xi, eta, s, e, nn, dlon;
+	int zone, j;
+
+	if (!(lat >= -80 && lat <= 84 && lon >= -180 && lon <= 180))
+		return 0;
+	if (!a) {
+		n = WGS84_F / (2 - WGS84_F);
+		a = WGS84_A / (1 + n) * (1 + n*n/4 + n*n*n*n/64);
+		alpha[0] = n/2 - 2*n*n/3 + 5*n*n*n/16;
+		alpha[1] = 13*n*n/48 - 3*n*n*n/5;
+		alpha[2] = 61*n*n*n/240;
+		c = 2 * sqrt(n) / (1 + n);
+	}
+	if (lon >= 180)
+		lon -= 360;
+	zone = (int)((lon + 180) / 6) + 1;
+	if (zone > 60)
+		zone = 60;
+	*band = bands[(int)((lat + 80) / 8)];
+	/* Norway & Svalbard */
+	if (*band == 'V' && zone == 31 && lon >= 3)
+		zone = 32;
+	else if (*band == 'X' && zone >= 32 && zone <= 37)
+		zone = (lon < 9) ? 31 : (lon < 21) ? 33 : (lon < 33) ? 35 : 37;
+	dlon = (lon - (zone * 6 - 183)) * M_PI / 180;
+
+	s = sin(lat * M_PI / 180);
+	t = sinh(atanh(s) - c * atanh(c * s));
+	xi = atan2(t, cos(dlon));
+	eta = atanh(sin(dlon) / sqrt(1 + t*t));
+	e = eta;
+	nn = xi;
+	for (j = 0; j < 3; ++j) {
+		e += alpha[j] * cos(2*(j+1)*xi) * sinh(2*(j+1)*eta);
+		nn += alpha[j] * sin(2*(j+1)*xi) * cosh(2*(j+1)*eta);
+	}
+	*east = 500000 + 0.9996 * a * e;
+	*north = (lat < 0 ? 10000000 : 0) + 0.9996 * a * nn;
+	return zone;
+}
+
+static void derive_fix(double lat, double lon, double h)
+{
+	double ecef[3], enu[3], east, north;
+	char band;
+	int zone;
+
+	if (isnan(lat) || isnan(lon)) {
+		if (derive_ecef)
+			publish_topic("ecef", "%s", "");
+		if (have_origin)
+			publish_topic("enu", "%s", "");
+		if (derive_utm)
+			publish_topic("utm", "%s", "");
+		return;
+	}
+	if (isnan(h))
+		h = 0;
+	if (derive_ecef || have_origin)
+		geodetic_to_ecef(lat, lon, h, ecef);
+	if (derive_ecef)
+		publish_topic("ecef", "%.3lf %.3lf %.3lf", ecef[0], ecef[1], ecef[2]);
+	if (have_origin) {
+		ecef_to_enu(ecef, enu);
+		publish_topic("enu", "%.3lf %.3lf %.3lf", enu[0], enu[1], enu[2]);
+	}
+	if (derive_utm) {
+		zone = geodetic_to_utm(lat, lon, &band, &east, &north);
+		if (zone)
+			publish_topic("utm", "%i%c %.3lf %.3lf", zone, band, east, north);
+		else
+			publish_topic("utm", "%s", "");
+	}
+}
+
+/* predicted position
+ * An alpha-beta tracker, the steady state Kalman filter of a constant
+ * velocity model, in meters around <lat0,lon0>.
+ * <predict_hz> times per second, the position is extrapolated to now.
+ */
+/* m/s^2 */
+#define PRED_ACCEL	2.0
+/* m, from epoch to epoch, the absolute error is mostly correlated */
+#define PRED_NOISE	0.5
+/* re-center beyond 10km */
+#define PRED_RECENTER	10000
+static double predict_hz;
+static struct {
+	/* fixes since (re)start */
+	int valid;
+	double lat0, lon0, mlon;
+	double x, y, vx, vy;
+	double tod;
+	/* CLOCK_MONOTONIC of the fix */
+	int64_t rx;
+} pred;
+
+static int64_t mono_ns(void);
+
+static void predict_fix(double lat, double lon, double tod, double hdop)
+{
+	double zx, zy, dt, lambda, r, alpha, beta, sigma;
+
+	dt = tod - pred.tod;
+	if (dt < -43200)
+		dt += 86400;
+	zx = (lon - pred.lon0) * pred.mlon;
+	zy = (lat - pred.lat0) * M_PER_DEG;
+	if (!pred.valid || isnan(dt) || dt <= 0 || dt > 10 ||
+			hypot(zx, zy) > PRED_RECENTER) {
+		/* (re)start */
+		pred.lat0 = lat;
+		pred.lon0 = lon;
+		pred.mlon = M_PER_DEG * cos(lat * M_PI / 180);
+		pred.x = pred.y = pred.vx = pred.vy = 0;
+		if (!isnan(lastfix.speed) && !isnan(lastfix.heading)) {
+			pred.vx = lastfix.speed / 3.6 * sin(lastfix.heading * M_PI / 180);
+			pred.vy = lastfix.speed / 3.6 * cos(lastfix.heading * M_PI / 180);
+		}
+		pred.valid = !isnan(tod);
+	} else if (pred.valid == 1 && (isnan(lastfix.speed) || isnan(lastfix.heading))) {
+		/* the velocity from the first 2 fixes */
+		pred.vx = (zx - pred.x) / dt;
+		pred.vy = (zy - pred.y) / dt;
+		pred.x = zx;
+		pred.y = zy;
+		++pred.valid;
+	} else {
+		/* Kalata's gains, for the tracking index of this interval */
+		sigma = PRED_NOISE * (isnan(hdop) ? 1 : fmax(hdop, 0.5));
+		lambda = PRED_ACCEL * dt * dt / sigma;
+		r = (4 + lambda - sqrt(8 * lambda + lambda * lambda)) / 4;
+		alpha = 1 - r * r;
+		beta = 2 * (2 - alpha) - 4 * sqrt(1 - alpha);
+		pred.x += pred.vx * dt;
+		pred.y += pred.vy * dt;
+		pred.vx += beta / dt * (zx - pred.x);
+		pred.vy += beta / dt * (zy - pred.y);
+		pred.x += alpha * (zx - pred.x);
+		pred.y += alpha * (zy - pred.y);
+		pred.valid = 2;
+	}
+	pred.tod = tod;
+	pred.rx = mono_ns();
+}
+
+static void predict_tick(void)
+{
+	double dt, maxage, x, y;
+
+	if (!pred.valid)
+		return;
+	dt = (mono_ns() - pred.rx) * 1e-9;
+	/* 2 epochs */
+	maxage = selected->ep.period ? selected->ep.period * 2e-3 : 2;
+	if (dt > maxage)
+		/* no recent fix, don't guess */
+		return;
+	x = pred.x + pred.vx * dt;
+	y = pred.y + pred.vy * dt;
+	publish_topicrt(NULL, "predict", 0, "%.7lf %.7lf",
+			pred.lat0 + y / M_PER_DEG, pred.lon0 + x / pred.mlon);
+}
+
+static void recvd_gga_gns(const char *msg)
+{
+	struct nmea_gga gga;
+	int ival;
+
+	nmea_decode_gga_gns(msg, &gga);
+	input_metrics(&gga);
+	epoch_start(gga.tod, gga.quality < 0 ? EP_GNS : EP_GGA);
+	lastfix.tod = gga.tod;
+	lastfix.lat = gga.lat;
+	lastfix.lon = gga.lon;
+	lastfix.alt = gga.alt;
+	lastfix.hdop = gga.hdop;
+	lastfix.satuse = gga.satuse;
+	if (gga.quality >= 0)
+		lastfix.quality = gga.quality;
+	fixdirty |= FIX_POS;
+	publish_topic("lat", "%.7lf", gga.lat);
+	publish_topic("lon", "%.7lf", gga.lon);
+	/* fix */
+	if (gga.quality >= 0) {
+		publish_topic("quality", "%s", fromtable(strquality, gga.quality) ?: "");
+	} else {
+		/* gns message */
+		static const char gns_modes[] = "NADPRFEMS";
+		static const char *const talkers[] = {
+			"gp",
+			"gl",
+			"gb",
+			"ga",
+			NULL,
+		};
+		const char *const *talker;
+		const char *chr;
+		const char *tok;
+
+		for (tok = gga.modes, talker = talkers;
+				*talker && *tok; ++tok, ++talker) {
+			chr = strchr(gns_modes, toupper(*tok));
+			ival = chr ? chr - gns_modes : 0;
+			publish_topicrt(*talker, "mode", 1,
+					"%s", fromtable(strquality, ival) ?: "");
+		}
+	}
+	/* sats-in-use */
+	publish_topicr("satuse", FL_RETAIN | FL_IGN_DEF_TALKER, "%i", gga.satuse);
+	satuse_updated(talker, gga.satuse);
+	if (nmea_use_msg("GSA"))
+		/* publish hdop from GGA only if GSA is not used */
+		publish_topic("hdop", "%.1lf", gga.hdop);
+	publish_topic("alt", "%.1lf", gga.alt);
+	publish_topic("geoid", "%.1lf", gga.geoid);
+	/* differential data
+	 */
+	publish_topic("diff/age", "%s", gga.diffage);
+	publish_topic("diff/id", "%s", gga.diffid);
+	publish_utc_nodate(gga.tod);
+	if (curinput->rank > 0)
+		geofence_fix(gga.lat, gga.lon, gga.tod);
+	if (derive_ecef || derive_utm || have_origin)
+		/* ellipsoidal height */
+		derive_fix((curinput->rank > 0) ? gga.lat : NAN, gga.lon,
+				gga.alt + (isnan(gga.geoid) ? 0 : gga.geoid));
+	if (predict_hz > 0 && curinput->rank > 0 && !isnan(gga.lat) && !isnan(gga.lon))
+		predict_fix(gga.lat, gga.lon, gga.tod, gga.hdop);
+	if (track_tol <= 0)
+		return;
+	if (curinput->rank <= 0 || isnan(gga.lat) || isnan(gga.lon))
+		track_end();
+	else
+		track_add(gga.lat, gga.lon, (utcday >= 0 && !isnan(gga.tod)) ? utcday + gga.tod : NAN);
+}
+
+static void recvd_gsa(void)
+{
+	struct nmea_gsa gsa;
+	int j;
+
+	nmea_decode_gsa(&gsa);
+	fixmode = gsa.mode;
+	fixmodetod = epoch_tod;
+	/* collect the used satellites of this epoch, over all systems */
+	if (epoch_tod != usedtod) {
+		nusedprns = 0;
+		usedtod = epoch_tod;
+	}
+	for (j = 0; j < gsa.nprn && nusedprns < MAXUSED; ++j)
+		usedprns[nusedprns++] = gsa.prn[j];
+	if (gsa.sysid == 1) {
+		/* only print on first packet */
+		publish_topic("mode", "%s", fromtable(strmode, gsa.mode) ?: "");
+		publish_topic("pdop", "%.1lf", gsa.pdop);
+		publish_topic("hdop", "%.1lf", gsa.hdop);
+		publish_topic("vdop", "%.1lf", gsa.vdop);
+	}
+}
+
+/* GSV: keep track of satellites */
+struct sat {
+	int snr;
+	int elv;
+	int azm;
+	int8_t recvd; /* recvd from NMEA */
+	int8_t sent; /* sent to MQTT */
+	int8_t seeded; /* recvd from broker, not yet refreshed */
+};
+static struct sat *sats;
+static int ssats;
+/* limit the sats table */
+#define MAXPRN	1024
+
+static void grow_sats(int prn)
+{
+	int oldssats = ssats;
+
+	if (prn < ssats)
+		return;
+	ssats = (prn + 128) & ~127;
+	sats = realloc(sats, sizeof(*sats)*ssats);
+	if (!sats)
+		mylog(LOG_ERR | LOG_EXIT, "realloc %i sats: %s", ssats, ESTR(errno));
+	memset(sats+oldssats, 0, sizeof(*sats)*(ssats - oldssats));
+}
+/* range of sat. ids:
+ * 1..32: GPS
+ * 33..54: SBAS
+ * 64..88/96: GLONASS
+ * 193..195: QZSS
+ * 201..235: Beidou
+ * 301..336: Galileo
+ */
+
+struct gsv {
+	char talker[3];
+	int satmin, satmax;
+	int satview;
+	int sattrack, sattrack_saved;
+	int satuse;
+	int new;
+	time_t trecvd;
+	/* msgidx of the next GSV, 0 when unknown */
+	int nextidx;
+};
+
+static struct gsv *gsvs;
+static int ngsvs, sgsvs;
+
+static void clear_sat(const char *talker, int prn);
+
+static struct gsv *find_gsv(const char *talker)
+{
+	struct gsv *gsv, *gsvend;
+
+	gsvend = gsvs+ngsvs;
+	for (gsv = gsvs; gsv < gsvend; ++gsv) {
+		if (!strcmp(talker, gsv->talker))
+			break;
+	}
+	if (gsv >= gsvend) {
+		if (ngsvs >= sgsvs) {
+			sgsvs += 16;
+			gsvs = realloc(gsvs, sgsvs*sizeof(*gsvs));
+			if (!gsvs)
+				mylog(LOG_ERR | LOG_EXIT, "realloc %u gsvs: %s", sgsvs, ESTR(errno));
+		}
+		gsv = gsvs+ngsvs++;
+		/* init new gsv struct */
+		memset(gsv, 0, sizeof(*gsv));
+		strcpy(gsv->talker, talker);
+		gsv->new = 1;
+	}
+	return gsv;
+}
+
+static int gn_satuse_emitted;
+static void satuse_updated(const char *talker, int satuse)
+{
+	struct gsv *gsv;
+	int j, gn_satuse;
+
+	if (!strcmp(talker ?: "", "gn")) {
+		gn_satuse_emitted = 1;
+		/* ignore "GN", I'm aggregating it */
+		return;
+	}
+	if (gn_satuse_emitted)
+		/* device emit's satuse already */
+		return;
+
+	gsv = find_gsv(talker);
+
+	if (always || gsv->satuse != satuse) {
+		gsv->satuse = satuse;
+		/* redo gn/satuse */
+		gn_satuse = 0;
+		for (j = 0; j < ngsvs; ++j)
+			gn_satuse += gsvs[j].satuse;
+		publish_topicrt("gn", "satuse", FL_RETAIN | FL_IGN_DEF_TALKER, "%i", gn_satuse);
+	}
+}
+
+static void recvd_gsv(void)
+{
+	struct nmea_gsv nmea;
+	int prn, elv, azm, snr;
+	int j;
+	struct gsv *gsv;
+	struct sat *sat;
+
+	gsv = find_gsv(talker);
+
+	nmea_decode_gsv(&nmea);
+	if (nmea.nsat < 0 || nmea.nsat > MAXPRN) {
+		mylog(LOG_WARNING, "%s gsv: bad #sats %i", file, nmea.nsat);
+		return;
+	}
+
+	gsv->trecvd = time(NULL);
+	if (gsv->nextidx && nmea.msgidx != gsv->nextidx)
+		/* (part of) a sequence got lost */
+		++curinput->ep.gsvgaps;
+	gsv->nextidx = (nmea.msgidx < nmea.msgcnt) ? nmea.msgidx + 1 : 1;
+	if (nmea.msgidx == 1) {
+		/* start of block */
+		for (j = gsv->satmin; j <= gsv->satmax && j < ssats; ++j)
+			sats[j].recvd = 0;
+		gsv->sattrack = 0;
+	}
+
+	for (j = 0; j < nmea.nsv; ++j) {
+		prn = nmea.sv[j].prn;
+		elv = nmea.sv[j].elv;
+		azm = nmea.sv[j].azm;
+		snr = nmea.sv[j].snr;
+
+		if (prn <= 0 || prn >= MAXPRN) {
+			mylog(LOG_WARNING, "%s gsv: bad prn %i", file, prn);
+			continue;
+		}
+		grow_sats(prn);
+		sat = sats+prn;
+
+		/* publish satellite info non-retained.
+		 * retained messages should be cleaned up,
+		 * which implies that we must listen to our own sat info
+		 * an remove 'lost' satellites ...
+		 */
+#define GSV_FLAGS	(FL_RETAIN | FL_NO_CACHE | FL_IGN_DEF_TALKER)
+		if (always || !sat->sent || elv != sat->elv)
+			publish_topicr(mktopic("sat/%i/elv", prn), GSV_FLAGS, "%i", elv);
+		if (always || !sat->sent || azm != sat->azm)
+			publish_topicr(mktopic("sat/%i/azm", prn), GSV_FLAGS, "%i", azm);
+		if (always || !sat->sent || snr != sat->snr)
+			publish_topicr(mktopic("sat/%i/snr", prn), GSV_FLAGS, (snr < 0) ? "" : "%i", snr);
+		sat->elv = elv;
+		sat->azm = azm;
+		sat->snr = snr;
+		sat->recvd = 1;
+		sat->sent = 1;
+		sat->seeded = 0;
+
+		/* count nr. of really recvd sats */
+		if (sat->snr >= 0)
+			++gsv->sattrack;
+
+		/* keep track of min/max prn of a talker */
+		if (prn < gsv->satmin || !gsv->satmax)
+			gsv->satmin = prn;
+		if (prn > gsv->satmax)
+			gsv->satmax = prn;
+	}
+	if (nmea.msgidx == nmea.msgcnt) {
+		for (j = gsv->satmin; j < gsv->satmax; ++j)
+			if (sats[j].sent && !sats[j].recvd)
+				clear_sat(talker, j);
+		/* emit number of sats in view
+		 * not to confuse with 'satvis' which is actually 'satinuse'
+		 * This can also act as a terminator of the satellite list
+		 */
+		if (always || gsv->new || nmea.nsat != gsv->satview)
+			/* do not cache, it serves to terminate the block */
+			publish_topicr("satview", FL_IGN_DEF_TALKER, "%i", nmea.nsat);
+		gsv->satview = nmea.nsat;
+		if (always || gsv->new || gsv->sattrack != gsv->sattrack_saved)
+			publish_topicr("sattrack", FL_IGN_DEF_TALKER, "%i", gsv->sattrack);
+		gsv->sattrack_saved = gsv->sattrack;
+		gsv->new = 0;
+
+		int satview = 0;
+		int sattrack = 0;
+		for (j = 0; j < ngsvs; ++j) {
+			satview += gsvs[j].satview;
+			sattrack += gsvs[j].sattrack_saved;
+		}
+		publish_topicrt("gn", "satview", FL_RETAIN | FL_IGN_DEF_TALKER, "%i", satview);
+		publish_topicrt("gn", "sattrack", FL_RETAIN | FL_IGN_DEF_TALKER, "%i", sattrack);
+		fixdirty |= FIX_SATS;
+	}
+}
+
+static void clear_sat(const char *talker, int prn)
+{
+	if (prn >= ssats)
+		return;
+	if (sats[prn].sent) {
+		/* remove retained msgs */
+		publish_topicrt(talker, mktopic("sat/%i/elv", prn), GSV_FLAGS, NULL);
+		publish_topicrt(talker, mktopic("sat/%i/azm", prn), GSV_FLAGS, NULL);
+		publish_topicrt(talker, mktopic("sat/%i/snr", prn), GSV_FLAGS, NULL);
+	}
+	memset(&sats[prn], 0, sizeof(sats[prn]));
+}
+
+/* seed cache & sats from a retained topic */
+static void seed_topic(const char *topic, const char *payload)
+{
+	const char *stopic = topic + topicprefixlen;
+	char stalker[3], field[4];
+	int prn, n;
+	struct topic *it;
+	struct gsv *gsv;
+	struct sat *sat;
+
+	if (sscanf(stopic, "%2[a-z]/sat/%i/%3[a-z]%n", stalker, &prn, field, &n) == 3 && !stopic[n]) {
+		if (prn <= 0 || prn >= MAXPRN)
+			return;
+		grow_sats(prn);
+		sat = sats+prn;
+		if (!strcmp(field, "elv"))
+			sat->elv = strtol(payload, NULL, 10);
+		else if (!strcmp(field, "azm"))
+			sat->azm = strtol(payload, NULL, 10);
+		else if (!strcmp(field, "snr"))
+			sat->snr = *payload ? strtol(payload, NULL, 10) : -1;
+		else
+			return;
+		sat->sent = 1;
+		sat->seeded = 1;
+		gsv = find_gsv(stalker);
+		if (prn < gsv->satmin || !gsv->satmax)
+			gsv->satmin = prn;
+		if (prn > gsv->satmax)
+			gsv->satmax = prn;
+		return;
+	}
+	for (it = topics; it; it = it->next) {
+		if (!strcmp(it->topic, topic))
+			return;
+	}
+	it = alloc_topic();
+	if (!topics)
+		topics = lasttopic = it;
+	else {
+		lasttopic->next = it;
+		lasttopic = it;
+	}
+	it->topic = topic_strdup(topic);
+	it->retain = 1;
+	it->ctrltopic = 1;
+	it->seeded = 1;
+	it->cls = topic_class(topic, FL_RETAIN);
+	set_payload(it, payload);
+}
+
+/* clear seeded topics that were not refreshed */
+static void sweep_seeded(void)
+{
+	struct topic *it;
+	struct gsv *gsv;
+	int j, n;
+
+	for (n = 0, it = topics; it; it = it->next) {
+		if (!it->seeded)
+			continue;
+		it->seeded = 0;
+		if (!it->payload)
+			continue;
+		it->payload = NULL;
+		mark_written(it);
+		++ndirty;
+		++n;
+	}
+	flush_pending_topics();
+	for (gsv = gsvs; gsv < gsvs+ngsvs; ++gsv) {
+		for (j = gsv->satmin; j <= gsv->satmax && j < ssats; ++j) {
+			if (sats[j].seeded) {
+				clear_sat(gsv->talker, j);
+				++n;
+			}
+		}
+	}
+	if (n)
+		mylog(LOG_INFO, "cleared %i orphaned retained topics", n);
+}
+
+static void clear_gsvs(void)
+{
+	int j, k;
+	struct gsv *gsv;
+
+	for (j = 0, gsv = gsvs; j < ngsvs; ++j, ++gsv) {
+		for (k = gsv->satmin; k <= gsv->satmax; ++k)
+			clear_sat(gsv->talker, k);
+		publish_topicrt(gsv->talker, "satview", GSV_FLAGS, NULL);
+		publish_topicrt(gsv->talker, "sattrack", GSV_FLAGS, NULL);
+		gsv->satview = 0;
+		gsv->sattrack = 0;
+		gsv->sattrack_saved = 0;
+	}
+	ngsvs = 0;
+	sgsvs = 0;
+	ssats = 0;
+	if (sats)
+		free(sats);
+	sats = NULL;
+	if (gsvs)
+		free(gsvs);
+	gsvs = NULL;
+}
+
+/* shared memory */
+static void shm_init(void)
+{
+	shm = nmeashm_create(shmname);
+	if (!shm)
+		mylog(LOG_ERR | LOG_EXIT, "shm %s: %s", shmname, ESTR(errno));
+	lastfix.alive = 1;
+	nmeashm_write(shm, &lastfix);
+}
+
+static void fix_commit(void)
+{
+	struct timespec ts;
+	struct sat *sat;
+	int j;
+
+	if (!fixdirty || (!shm && gpsdfd < 0)) {
+		fixdirty = 0;
+		return;
+	}
+	if (fixdirty & FIX_SATS) {
+		/* rebuild the satellite table, only once per GSV block */
+		lastfix.nsats = 0;
+		for (j = 1; j < ssats && lastfix.nsats < NMEASHM_MAXSATS; ++j) {
+			sat = sats+j;
+			if (!sat->recvd)
+				continue;
+			lastfix.sats[lastfix.nsats++] = (struct nmeashm_sat){
+				.prn = j,
+				.elv = sat->elv,
+				.azm = sat->azm,
+				.snr = sat->snr,
+			};
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	lastfix.updated = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	++lastfix.nupdates;
+	if (shm)
+		nmeashm_write(shm, &lastfix);
+	if (gpsdfd >= 0)
+		gpsd_fix(fixdirty);
+	fixdirty = 0;
+}
+
+static void shm_exit(void)
+{
+	if (!shm)
+		return;
+	lastfix.alive = 0;
+	fixdirty |= FIX_POS;
+	fix_commit();
+}
+
+static void recvd_txt(void)
+{
+	unsigned int level;
+	const char *msg;
+	static const int levels[256] = {
+		[0] = LOG_ERR,
+		[1] = LOG_WARNING,
+		[2] = LOG_NOTICE,
+		[7] = LOG_INFO,
+	};
+
+	nmea_tok(NULL);
+	nmea_tok(NULL);
+
+	level = strtoul(nmea_safe_tok(NULL), NULL, 10);
+	msg = nmea_tok(NULL);
+
+	if (level < sizeof(levels)/sizeof(levels[0]) && levels[level] && msg)
+		mylog(levels[level], "%s %c%cTXT '%s'", file, toupper(talker[0]), toupper(talker[1]), msg);
+}
+
+static void recvd_vtg(void)
+{
+	struct nmea_vtg vtg;
+
+	nmea_decode_vtg(&vtg);
+	lastfix.speed = vtg.speed;
+	lastfix.heading = vtg.heading;
+	fixdirty |= FIX_POS;
+	publish_topic("heading", "%.2lf", vtg.heading);
+	publish_topic("heading/magnetic", "%.2lf", vtg.magnetic);
+	publish_topic("speed", "%.2lf", vtg.speed);
+}
+
+/* publish utc & datetime from a time of day and a date */
+static void recvd_zda(void)
+{
+	struct nmea_zda zda;
+
+	nmea_decode_zda(&zda);
+	epoch_start(zda.tod, EP_ZDA);
+	publish_utc(zda.tod, zda.mday, zda.mon, zda.year);
+}
+
+/* RMC carries position, speed, heading & date in 1 sentence,
+ * enough for a receiver that emits only RMC (+GGA)
+ */
+/* RMC or GLL without fix, don't let the last position look current */
+static void fix_lost(double tod)
+{
+	lastfix.tod = tod;
+	lastfix.lat = lastfix.lon = NAN;
+	/* invalid */
+	lastfix.quality = 0;
+	fixdirty |= FIX_POS;
+}
+
+static void recvd_rmc(void)
+{
+	struct nmea_rmc rmc;
+
+	nmea_decode_rmc(&rmc);
+	epoch_start(rmc.tod, EP_RMC);
+	if (rmc.status != 'A' || rmc.mode == 'N') {
+		/* no fix */
+		publish_topic("lat", "%s", "");
+		publish_topic("lon", "%s", "");
+		fix_lost(rmc.tod);
+	} else {
+		publish_topic("lat", "%.7lf", rmc.lat);
+		publish_topic("lon", "%.7lf", rmc.lon);
+		publish_topic("speed", "%.2lf", rmc.speed);
+		/* heading is often empty when standing still */
+		if (!isnan(rmc.heading))
+			publish_topic("heading", "%.2lf", rmc.heading);
+		lastfix.tod = rmc.tod;
+		lastfix.lat = rmc.lat;
+		lastfix.lon = rmc.lon;
+		lastfix.speed = rmc.speed;
+		if (!isnan(rmc.heading))
+			lastfix.heading = rmc.heading;
+		fixdirty |= FIX_POS;
+		geofence_fix(rmc.lat, rmc.lon, rmc.tod);
+	}
+	publish_utc(rmc.tod, rmc.mday, rmc.mon, rmc.year);
+}
+
+static void recvd_gll(void)
+{
+	struct nmea_gll gll;
+
+	nmea_decode_gll(&gll);
+	epoch_start(gll.tod, EP_GLL);
+	if (gll.status != 'A' || gll.mode == 'N') {
+		publish_topic("lat", "%s", "");
+		publish_topic("lon", "%s", "");
+		fix_lost(gll.tod);
+	} else {
+		publish_topic("lat", "%.7lf", gll.lat);
+		publish_topic("lon", "%.7lf", gll.lon);
+		lastfix.tod = gll.tod;
+		lastfix.lat = gll.lat;
+		lastfix.lon = gll.lon;
+		fixdirty |= FIX_POS;
+	}
+	publish_utc_nodate(gll.tod);
+}
+
+static void recvd_gst(void)
+{
+	struct nmea_gst gst;
+
+	nmea_decode_gst(&gst);
+	publish_topic("accuracy/rms", "%.3lf", gst.rms);
+	publish_topic("accuracy/lat", "%.3lf", gst.lat);
+	publish_topic("accuracy/lon", "%.3lf", gst.lon);
+	publish_topic("accuracy/alt", "%.3lf", gst.alt);
+}
+
+/* runtime defined decoders */
+#define SCHEMA_MAXFIELDS 64
+enum {
+	FT_INT,
+	FT_FLOAT,
+	FT_STR,
+	FT_DEG,
+};
+static const char *const strftype[] = {
+	[FT_INT] = "int",
+	[FT_FLOAT] = "float",
+	[FT_STR] = "str",
+	[FT_DEG] = "deg",
+};
+
+struct field {
+	int idx;
+	int type;
+	int decimals;
+	double scale;
+	char *topic;
+};
+
+struct schema {
+	/* as in the file: PASHR, PUBX,00 or HDT */
+	char *name;
+	/* PASHR, or HDT for any talker */
+	char *id;
+	/* required value of field 1, like '00' for PUBX,00 */
+	char *sub;
+	int proprietary;
+	int nfields;
+	struct field *fields;
+};
+static struct schema *schemas;
+static int nschemas;
+
+static struct schema *get_schema(const char *id)
+{
+	struct schema *sch;
+	char *sub;
+
+	for (sch = schemas; sch < schemas+nschemas; ++sch) {
+		if (!strcmp(sch->name, id))
+			return sch;
+	}
+	schemas = realloc(schemas, sizeof(*schemas)*(nschemas+1));
+	if (!schemas)
+		mylog(LOG_ERR | LOG_EXIT, "realloc schemas: %s", ESTR(errno));
+	sch = schemas + nschemas++;
+	memset(sch, 0, sizeof(*sch));
+	sch->name = strdup(id);
+	sch->id = strdup(id);
+	sub = strchr(sch->id, ',');
+	if (sub) {
+		*sub++ = 0;
+		sch->sub = sub;
+	}
+	sch->proprietary = sch->id[0] == 'P';
+	return sch;
+}
+
+static void load_schema(const char *filename)
+{
+	FILE *fp;
+	char *line = NULL, *id, *sidx, *stype, *sscale, *topic, *str;
+	size_t linesize = 0;
+	int lineno = 0, type, decimals;
+	long idx;
+	double scale;
+	struct schema *sch;
+	struct field *field;
+
+	fp = fopen(filename, "r");
+	if (!fp)
+		mylog(LOG_ERR | LOG_EXIT, "fopen %s: %s", filename, ESTR(errno));
+	while (getline(&line, &linesize, fp) > 0) {
+		++lineno;
+		id = strtok(line, " \t\r\n");
+		if (!id || *id == '#')
+			continue;
+		sidx = strtok(NULL, " \t\r\n");
+		stype = strtok(NULL, " \t\r\n");
+		sscale = strtok(NULL, " \t\r\n");
+		topic = strtok(NULL, " \t\r\n");
+		if (!topic)
+			mylog(LOG_ERR | LOG_EXIT, "%s:%i: incomplete line", filename, lineno);
+
+		idx = strtol(sidx, &str, 0);
+		if (*str || idx < 1 || idx >= SCHEMA_MAXFIELDS)
+			mylog(LOG_ERR | LOG_EXIT, "%s:%i: bad field '%s'", filename, lineno, sidx);
+		decimals = 0;
+		str = strchr(stype, '.');
+		if (str) {
+			*str++ = 0;
+			decimals = strtoul(str, NULL, 10);
+		}
+		for (type = 0; type < sizeof(strftype)/sizeof(strftype[0]); ++type) {
+			if (!strcmp(stype, strftype[type]))
+				break;
+		}
+		if (type >= sizeof(strftype)/sizeof(strftype[0]))
+			mylog(LOG_ERR | LOG_EXIT, "%s:%i: unknown type '%s'", filename, lineno, stype);
+		if (type == FT_DEG && idx+1 >= SCHEMA_MAXFIELDS)
+			mylog(LOG_ERR | LOG_EXIT, "%s:%i: bad field '%s'", filename, lineno, sidx);
+		scale = strtod(sscale, &str);
+		if (*str)
+			mylog(LOG_ERR | LOG_EXIT, "%s:%i: bad scale '%s'", filename, lineno, sscale);
+
+		sch = get_schema(id);
+		sch->fields = realloc(sch->fields, sizeof(*sch->fields)*(sch->nfields+1));
+		if (!sch->fields)
+			mylog(LOG_ERR | LOG_EXIT, "realloc fields: %s", ESTR(errno));
+		field = sch->fields + sch->nfields++;
+		field->idx = idx;
+		field->type = type;
+		field->decimals = decimals;
+		field->scale = scale;
+		field->topic = strdup(topic);
+	}
+	free(line);
+	fclose(fp);
+	mylog(LOG_INFO, "%s: %i schemas", filename, nschemas);
+}
+
+/* decode a sentence with the runtime schemas,
+ * return 0 when no schema applies
+ */
+static int recvd_schema(const char *id)
+{
+	char *flds[SCHEMA_MAXFIELDS];
+	int j, nflds = 0, found = 0;
+	struct schema *sch;
+	struct field *field;
+	const char *tk, *str;
+	double val;
+
+	for (sch = schemas; sch < schemas+nschemas; ++sch) {
+		if (strcmp(sch->id, sch->proprietary ? id : id+2))
+			continue;
+		if (!nflds) {
+			/* split the sentence once */
+			flds[nflds++] = (char *)id;
+			for (; nflds < SCHEMA_MAXFIELDS; ++nflds) {
+				flds[nflds] = nmea_field();
+				if (!flds[nflds])
+					break;
+			}
+		}
+		if (sch->sub && (nflds < 2 || strcmp(sch->sub, flds[1])))
+			continue;
+		found = 1;
+		/* proprietary sentences have no talker */
+		tk = sch->proprietary ? NULL : talker;
+		for (field = sch->fields; field < sch->fields+sch->nfields; ++field) {
+			str = (field->idx < nflds) ? flds[field->idx] : "";
+			switch (field->type) {
+			case FT_INT:
+				publish_topicrt(tk, field->topic, FL_RETAIN | FL_DATA, "%.0lf", nmea_strtod(str)*field->scale);
+				break;
+			case FT_FLOAT:
+				publish_topicrt(tk, field->topic, FL_RETAIN | FL_DATA, "%.*lf", field->decimals, nmea_strtod(str)*field->scale);
+				break;
+			case FT_STR:
+				publish_topicrt(tk, field->topic, FL_RETAIN | FL_DATA, "%s", str);
+				break;
+			case FT_DEG:
+				val = nmea_deg_to_double(str);
+				j = field->idx+1;
+				if (j < nflds && strchr("SW", *flds[j] ?: '-'))
+					val *= -1;
+				publish_topicrt(tk, field->topic, FL_RETAIN | FL_DATA, "%.7lf", val);
+				break;
+			}
+		}
+	}
+	return found;
+}
+
+static void recvd_line(char *line)
+{
+	char *tok;
+	struct topic *wmark;
+	int dirty0;
+	unsigned long flushes0;
+
+	if (!*line)
+		/* empty line */
+		return;
+	if (nmea_is_valid_sentence(line) < 0) {
+		++curinput->nbad;
+		return;
+	}
+	tok = nmea_tok(line);
+	if (!tok || strlen(tok) <= 2)
+		/* bad line ? */
+		return;
+	++nsentences;
+	in_data_sentence = 0;
+	/* don't test the precise talker id */
+	talker[0] = tolower(tok[0]);
+	talker[1] = tolower(tok[1]);
+
+	if (curpeer && !peer_identify(curpeer, tok))
+		/* unknown source */
+		goto done;
+	if (curinput != selected) {
+		/* only track the fix */
+		if (!strcmp(tok+2, "GGA") || !strcmp(tok+2, "GNS")) {
+			struct nmea_gga gga;
+
+			nmea_decode_gga_gns(tok, &gga);
+			input_metrics(&gga);
+			if (!isnan(gga.tod))
+				epoch_track(curinput, gga.tod, gga.quality < 0 ? EP_GNS : EP_GGA);
+		}
+		goto done;
+	}
+	/* throughput mode: where this sentence starts */
+	wmark = lastwtopic;
+	dirty0 = ndirty;
+	flushes0 = nflushes;
+	if (!strcmp(tok+2, "TXT"))
+		recvd_txt();
+	else if (nschemas && recvd_schema(tok))
+		;
+	else if (!nmea_use_msg(tok+2))
+		/* this sentence is blocked */
+		goto done;
+	else if (!strcmp(tok+2, "GGA") || !strcmp(tok+2, "GNS"))
+		recvd_gga_gns(tok);
+	else if (!strcmp(tok+2, "GSA"))
+		recvd_gsa();
+	else if (!strcmp(tok+2, "GSV"))
+		recvd_gsv();
+	else if (!strcmp(tok+2, "VTG"))
+		recvd_vtg();
+	else if (!strcmp(tok+2, "ZDA"))
+		recvd_zda();
+	else if (!strcmp(tok+2, "RMC"))
+		recvd_rmc();
+	else if (!strcmp(tok+2, "GLL"))
+		recvd_gll();
+	else if (!strcmp(tok+2, "GST"))
+		recvd_gst();
+	if (!throughput) {
+		flush_pending_topics();
+	} else if (!always) {
+		if (nflushes != flushes0) {
+			/* the previous epoch was flushed */
+			wmark = NULL;
+			dirty0 = 0;
+		}
+		if (ndirty == dirty0)
+			unmark_written(wmark);
+	}
+	fix_commit();
+	if (lowlatency)
+		lowlat_push();
+done:
+	in_data_sentence = 0;
+	if (reselect)
+		/* switch between sentences only */
+		input_select();
+}
+
+/* ublox */
+static uint16_t ublox_crc(const void *vdat, int len)
+{
+	const uint8_t *dat = vdat;
+	uint8_t cka = 0, ckb = 0;
+
+	for (; len; ++dat, --len) {
+		cka += *dat;
+		ckb += cka;
+	}
+	return (cka << 8) + ckb;
+}
+
+static void recvd_ublox_frame(const void *vdat, int len)
+{
+	const uint8_t *dat = vdat;
+	uint16_t f_ck, my_ck;
+	uint16_t clsid;
+
+	my_ck = ublox_crc(dat+2, len-4);
+	memcpy(&f_ck, dat+len-2, 2);
+	f_ck = be16toh(f_ck);
+	if (f_ck != my_ck) {
+		mylog(LOG_WARNING, "ublox: crc mismatch");
+		return;
+	}
+	memcpy(&clsid, dat+2, 2);
+	/* class/id is formatted as BigEndian */
+	clsid = be16toh(clsid);
+	mylog(LOG_INFO, "ublox: %04x+%u", clsid, len-8);
+}
+
+/* multiplexer */
+/* max. pending data without newline, must hold the largest ublox frame */
+#define MAXLINE	(65535+8)
+
+static void recvd_data(const char *line, int len)
+{
+	struct input *in = curinput;
+	char *str;
+	size_t bufpos;
+
+	if (in->buflen + len + 1 > in->bufsize) {
+		/* grow */
+		in->bufsize = (in->buflen+len+1+1023) & ~1023;
+		in->buf = realloc(in->buf, in->bufsize);
+		if (!in->buf)
+			mylog(LOG_ERR | LOG_EXIT, "realloc");
+	}
+	/* append */
+	memcpy(in->buf+in->buflen, line, len);
+	in->buflen += len;
+	in->buf[in->buflen] = 0; /* null terminate */
+	/* parse */
+	for (bufpos = 0;;) {
+		if ((in->buflen - bufpos) >= 2 && !memcmp(in->buf+bufpos, (uint8_t[]){ 0xb5, 0x62, }, 2)) {
+			/* ublox header */
+			uint16_t v16;
+
+			if ((in->buflen - bufpos) < 8)
+				/* incomplete empty ublox frame */
+				break;
+			memcpy(&v16, in->buf+bufpos+4, 2);
+			v16 = le16toh(v16);
+			if ((in->buflen - bufpos) < (v16+8))
+				/* incomplete ublox frame */
+				break;
+			if (in == selected)
+				recvd_ublox_frame(in->buf+bufpos, v16+8);
+			bufpos += v16+8;
+			continue;
+		}
+		str = memchr(in->buf+bufpos, '\n', in->buflen-bufpos);
+		if (!str) {
+			if (in->buflen - bufpos > MAXLINE) {
+				mylog(LOG_WARNING, "%s: drop %lu bytes without newline", in->name, (unsigned long)(in->buflen - bufpos));
+				bufpos = in->buflen;
+			}
+			break;
+		}
+		if (str > in->buf+bufpos && *(str-1) == '\r')
+			/* cut \r too */
+			*(str-1) = 0;
+		/* null-terminate */
+		*str++ = 0;
+		recvd_line(in->buf+bufpos);
+		bufpos = str-in->buf;
+	}
+	/* forget consumed data */
+	if (bufpos)
+		memmove(in->buf, in->buf+bufpos, in->buflen-bufpos+1);
+	in->buflen -= bufpos;
+	if (throughput)
+		/* end of batch */
+		flush_pending_topics();
+}
+
+/* event loop */
+enum {
+	EV_INPUT,
+	EV_MQTT,
+	EV_SIGNAL,
+	EV_DEAD,
+	EV_TICK,
+	EV_STATS,
+	EV_PREDICT,
+	EV_GPSD_LISTEN,
+	EV_GPSD,
+	EV_GPSD_FLUSH,
+	EV_GW_UDP,
+	EV_GW_LISTEN,
+	EV_GW_PEER,
+};
+
+static int epfd;
+
+static int ev_add(int fd, uint32_t events, int id)
+{
+	struct epoll_event ev = {
+		.events = events,
+		.data.u32 = id,
+	};
+
+	return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static int timer_new(int id)
+{
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0)
+		mylog(LOG_ERR | LOG_EXIT, "timerfd_create: %s", ESTR(errno));
+	if (ev_add(fd, EPOLLIN, id) < 0)
+		mylog(LOG_ERR | LOG_EXIT, "epoll_ctl add timer: %s", ESTR(errno));
+	return fd;
+}
+
+/* (re)arm a timer, in msec, 0 disarms */
+static void timer_set(int fd, int msec, int interval)
+{
+	struct itimerspec its = {
+		.it_value.tv_sec = msec / 1000,
+		.it_value.tv_nsec = msec % 1000 * 1000000,
+		.it_interval.tv_sec = interval / 1000,
+		.it_interval.tv_nsec = interval % 1000 * 1000000,
+	};
+
+	if (timerfd_settime(fd, 0, &its, NULL) < 0)
+		mylog(LOG_ERR | LOG_EXIT, "timerfd_settime: %s", ESTR(errno));
+}
+
+static void timer_ack(int fd)
+{
+	uint64_t n;
+
+	if (read(fd, &n, sizeof(n)) < 0 && errno != EAGAIN)
+		mylog(LOG_ERR | LOG_EXIT, "read timerfd: %s", ESTR(errno));
+}
+
+/* follow the mqtt socket, it changes on reconnect */
+static void mqtt_watch(struct broker *b)
+{
+	struct epoll_event ev = {
+		/* the event id carries the broker index */
+		.data.u32 = EV_MQTT | (b-brokers) << 8,
+	};
+	int fd, ret;
+
+	fd = mosquitto_socket(b->mosq);
+	ev.events = EPOLLIN | (mosquitto_want_write(b->mosq) ? EPOLLOUT : 0);
+	if (fd == b->fd && ev.events == b->events)
+		return;
+	if (fd != b->fd && b->fd >= 0)
+		/* fails when the old socket is closed already */
+		epoll_ctl(epfd, EPOLL_CTL_DEL, b->fd, NULL);
+	ret = (fd < 0) ? 0 : epoll_ctl(epfd, fd == b->fd ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev);
+	if (ret < 0 && errno == ENOENT)
+		/* a new socket with the old number, the old one left the set */
+		ret = epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+	else if (ret < 0 && errno == EEXIST)
+		/* forgotten by mqtt_lost, but still open */
+		ret = epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev);
+	if (ret < 0)
+		mylog(LOG_ERR | LOG_EXIT, "epoll_ctl mqtt: %s", ESTR(errno));
+	b->fd = fd;
+	b->events = ev.events;
+}
+
+/* throughput mode: coalesce the writes of a batch into fewer TCP segments */
+static void mqtt_cork(int on)
+{
+	struct broker *b;
+	int fd;
+
+	for (b = brokers; b < brokers+nbrokers; ++b) {
+		fd = mosquitto_socket(b->mosq);
+		if (fd >= 0)
+			/* fails on unix sockets, no harm */
+			setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+	}
+}
+
+/* low latency mode
+ * Inputs are busy polled, and each sentence is pushed to the socket
+ * right after its topics are flushed.
+ * The latency from read() until then is kept in a histogram.
+ */
+#define LATHIST		10000
+#define PREFAULT_STACK	(256 << 10)
+#define PREFAULT_HEAP	(4 << 20)
+/* read time of the current chunk, in nsec, or 0 */
+static int64_t rxtime;
+/* in usec, the last bin holds the slower ones */
+static unsigned long lathist[LATHIST+1];
+
+static int64_t mono_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void lowlat_push(void)
+{
+	struct broker *b;
+	int ret;
+	int64_t usec;
+
+	for (b = brokers; b < brokers+nbrokers; ++b) {
+		outq_flush(b);
+		if (mosquitto_want_write(b->mosq)) {
+			ret = mosquitto_loop_write(b->mosq, 1);
+			if (ret)
+				mqtt_lost(b, ret);
+		}
+	}
+	if (outfile)
+		fflush(outfile);
+	if (!rxtime)
+		return;
+	usec = (mono_ns() - rxtime) / 1000;
+	++lathist[usec < LATHIST ? usec : LATHIST];
+}
+
+static void lowlat_stats(void)
+{
+	unsigned long total, n;
+	int j, p50 = -1, p99 = -1, p999 = -1, max = 0;
+
+	for (j = 0, total = 0; j <= LATHIST; ++j) {
+		total += lathist[j];
+		if (lathist[j])
+			max = j;
+	}
+	if (!total)
+		return;
+	for (j = 0, n = 0; j <= LATHIST; ++j) {
+		n += lathist[j];
+		if (p50 < 0 && n*2 >= total)
+			p50 = j;
+		if (p99 < 0 && n*100 >= total*99)
+			p99 = j;
+		if (p999 < 0 && n*1000 >= total*999)
+			p999 = j;
+	}
+	mylog(LOG_NOTICE, "latency %lu sentences, p50 %ius, p99 %ius, p99.9 %ius, max %s%ius",
+			total, p50, p99, p999, max >= LATHIST ? ">" : "", max);
+}
+
+static void prefault_stack(void)
+{
+	volatile char stack[PREFAULT_STACK];
+	int j;
+
+	for (j = 0; j < sizeof(stack); j += 4096)
+		stack[j] = 0;
+}
+
+static void lowlat_init(void)
+{
+	struct sched_param sp = {
+		.sched_priority = rtprio,
+	};
+	cpu_set_t cpus;
+	volatile char *heap;
+	int j;
+
+	if (rtcpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(rtcpu, &cpus);
+		if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0)
+			mylog(LOG_WARNING, "sched_setaffinity %i: %s", rtcpu, ESTR(errno));
+	}
+	if (rtprio && sched_setscheduler(0, SCHED_FIFO, &sp) < 0)
+		mylog(LOG_WARNING, "sched_setscheduler SCHED_FIFO %i: %s", rtprio, ESTR(errno));
+
+	/* keep freed memory, it is faulted in already */
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) < 0)
+		mylog(LOG_WARNING, "mlockall: %s", ESTR(errno));
+	/* a heap reserve for the cache, the queues & the input buffers */
+	heap = malloc(PREFAULT_HEAP);
+	if (!heap)
+		mylog(LOG_ERR | LOG_EXIT, "malloc %u: %s", PREFAULT_HEAP, ESTR(errno));
+	for (j = 0; j < PREFAULT_HEAP; j += 4096)
+		heap[j] = 0;
+	free((void *)heap);
+	prefault_stack();
+}
+
+/* gpsd compatible JSON server
+ * Reports are encoded once per epoch and shared by reference
+ * among the clients' queues.
+ */
+struct report {
+	int refs;
+	int len;
+	char dat[];
+};
+
+#define GPSD_QLEN	64
+struct gpsdclient {
+	int fd;
+	int watch;
+	uint32_t events;
+	/* pending reports, and the sent part of the first */
+	struct report *q[GPSD_QLEN];
+	int qlen;
+	int qoff;
+	/* partial command */
+	char rx[256];
+	int rxlen;
+};
+static struct gpsdclient **gclients;
+static int sgclients, ngclients;
+static unsigned long gpsd_dropped;
+
+/* the pending epoch */
+static struct nmeashm_fix gpsdfix;
+static double gpsdtod = NAN;
+static int gpsddirty;
+/* msec of silence that completes an epoch */
+#define GPSD_FLUSH	20
+static int gpsdtfd = -1;
+/* last reports, for ?POLL */
+static struct report *lasttpv, *lastsky;
+
+static struct report *report_new(const char *dat, int len)
+{
+	struct report *rpt;
+
+	rpt = malloc(sizeof(*rpt) + len);
+	if (!rpt)
+		mylog(LOG_ERR | LOG_EXIT, "malloc report: %s", ESTR(errno));
+	rpt->refs = 1;
+	rpt->len = len;
+	memcpy(rpt->dat, dat, len);
+	return rpt;
+}
+
+static void report_put(struct report *rpt)
+{
+	if (rpt && !--rpt->refs)
+		free(rpt);
+}
+
+static void gpsd_close(int idx)
+{
+	struct gpsdclient *gc = gclients[idx];
+	int j;
+
+	epoll_ctl(epfd, EPOLL_CTL_DEL, gc->fd, NULL);
+	close(gc->fd);
+	for (j = 0; j < gc->qlen; ++j)
+		report_put(gc->q[j]);
+	free(gc);
+	gclients[idx] = NULL;
+	--ngclients;
+}
+
+static void gpsd_watch(int idx, uint32_t events)
+{
+	struct gpsdclient *gc = gclients[idx];
+	struct epoll_event ev = {
+		.events = events,
+		.data.u32 = EV_GPSD | idx << 8,
+	};
+
+	if (events == gc->events)
+		return;
+	if (epoll_ctl(epfd, EPOLL_CTL_MOD, gc->fd, &ev) < 0)
+		mylog(LOG_ERR | LOG_EXIT, "epoll_ctl gpsd: %s", ESTR(errno));
+	gc->events = events;
+}
+
+/* write as much as the socket takes, never block */
+static void gpsd_send(int idx)
+{
+	struct gpsdclient *gc = gclients[idx];
+	struct iovec vec[16];
+	int j, n;
+	ssize_t ret;
+
+	while (gc->qlen) {
+		for (n = 0; n < gc->qlen && n < 16; ++n) {
+			vec[n].iov_base = gc->q[n]->dat;
+			vec[n].iov_len = gc->q[n]->len;
+		}
+		vec[0].iov_base += gc->qoff;
+		vec[0].iov_len -= gc->qoff;
+		ret = writev(gc->fd, vec, n);
+		if (ret < 0 && errno == EAGAIN)
+			break;
+		if (ret < 0) {
+			gpsd_close(idx);
+			return;
+		}
+		ret += gc->qoff;
+		for (j = 0; j < gc->qlen && ret >= gc->q[j]->len; ++j) {
+			ret -= gc->q[j]->len;
+			report_put(gc->q[j]);
+		}
+		gc->qlen -= j;
+		memmove(gc->q, gc->q+j, gc->qlen * sizeof(gc->q[0]));
+		gc->qoff = ret;
+	}
+	gpsd_watch(idx, EPOLLIN | (gc->qlen ? EPOLLOUT : 0));
+}
+
+static void gpsd_queue(int idx, struct report *rpt)
+{
+	struct gpsdclient *gc = gclients[idx];
+	int j;
+
+	if (gc->qlen >= GPSD_QLEN) {
+		/* slow client, drop its oldest unsent report */
+		j = gc->qoff ? 1 : 0;
+		report_put(gc->q[j]);
+		memmove(gc->q+j, gc->q+j+1, (gc->qlen-j-1) * sizeof(gc->q[0]));
+		--gc->qlen;
+		++gpsd_dropped;
+	}
+	++rpt->refs;
+	gc->q[gc->qlen++] = rpt;
+}
+
+static void gpsd_broadcast(struct report *rpt)
+{
+	int j;
+
+	for (j = 0; j < sgclients; ++j) {
+		if (gclients[j] && gclients[j]->watch) {
+			gpsd_queue(j, rpt);
+			gpsd_send(j);
+		}
+	}
+}
+
+/* queue a private answer */
+__attribute__((format(printf,2,3)))
+static void gpsd_reply(int idx, const char *fmt, ...)
+{
+	va_list va;
+	char *str;
+	int len;
+	struct report *rpt;
+
+	va_start(va, fmt);
+	len = vasprintf(&str, fmt, va);
+	va_end(va);
+	if (len < 0)
+		mylog(LOG_ERR | LOG_EXIT, "vasprintf: %s", ESTR(errno));
+	rpt = report_new(str, len);
+	free(str);
+	gpsd_queue(idx, rpt);
+	report_put(rpt);
+}
+
+/* escape str for a JSON string, in a static buffer */
+static const char *json_esc(const char *str)
+{
+	static char buf[1024];
+	char *p = buf;
+
+	for (; *str && p < buf + sizeof(buf) - 7; ++str) {
+		if (*str == '"' || *str == '\\') {
+			*p++ = '\\';
+			*p++ = *str;
+		} else if ((unsigned char)*str < 0x20)
+			p += sprintf(p, "\\u%04x", *str);
+		else
+			*p++ = *str;
+	}
+	*p = 0;
+	return buf;
+}
+
+static const char *gpsd_device(void)
+{
+	return json_esc((selected ? selected->name : file) ?: "");
+}
+
+static const char *gpsd_time(double utc)
+{
+	static char str[64];
+	long long msec;
+	time_t tim;
+	struct tm tm;
+
+	if (isnan(utc))
+		return NULL;
+	/* round once, the fraction of utc is not exact */
+	msec = llround(utc * 1000);
+	tim = msec / 1000;
+	gmtime_r(&tim, &tm);
+	sprintf(str + strftime(str, sizeof(str), "%Y-%m-%dT%H:%M:%S", &tm),
+			".%03iZ", (int)(msec % 1000));
+	return str;
+}
+
+/* append ',"name":value' to str when value is valid */
+static char *json_num(char *str, const char *name, const char *fmt, double val)
+{
+	if (isnan(val))
+		return str;
+	str += sprintf(str, ",\"%s\":", name);
+	return str + sprintf(str, fmt, val);
+}
+
+static void gpsd_encode_epoch(void)
+{
+	static char buf[16384];
+	char *str;
+	const char *tim;
+	const struct nmeashm_fix *fix = &gpsdfix;
+	int j, k, mode, used;
+
+	/* GSA's mode is valid for its epoch only */
+	mode = (fixmode && fixmodetod == fix->tod) ? fixmode :
+		(fix->quality <= 0 ? 1 : isnan(fix->alt) ? 2 : 3);
+	tim = gpsd_time(fix->utc);
+
+	str = buf + sprintf(buf, "{\"class\":\"TPV\",\"device\":\"%s\",\"mode\":%i",
+			gpsd_device(), mode);
+	if (tim)
+		str += sprintf(str, ",\"time\":\"%s\"", tim);
+	if (mode >= 2) {
+		str = json_num(str, "lat", "%.9f", fix->lat);
+		str = json_num(str, "lon", "%.9f", fix->lon);
+		if (mode >= 3)
+			str = json_num(str, "alt", "%.3f", fix->alt);
+		/* gpsd speaks m/s */
+		str = json_num(str, "speed", "%.3f", fix->speed / 3.6);
+		str = json_num(str, "track", "%.4f", fix->heading);
+	}
+	str += sprintf(str, "}\r\n");
+	report_put(lasttpv);
+	lasttpv = report_new(buf, str - buf);
+	gpsd_broadcast(lasttpv);
+
+	if (!(gpsddirty & FIX_SATS))
+		return;
+	str = buf + sprintf(buf, "{\"class\":\"SKY\",\"device\":\"%s\"", gpsd_device());
+	if (tim)
+		str += sprintf(str, ",\"time\":\"%s\"", tim);
+	str = json_num(str, "hdop", "%.2f", fix->hdop);
+	str += sprintf(str, ",\"nSat\":%i,\"uSat\":%i,\"satellites\":[", fix->nsats, fix->satuse);
+	for (j = 0; j < fix->nsats; ++j) {
+		/* GSA's used satellites are valid for this epoch only */
+		for (used = k = 0; usedtod == gpsdtod && k < nusedprns; ++k) {
+			if (usedprns[k] == fix->sats[j].prn) {
+				used = 1;
+				break;
+			}
+		}
+		str += sprintf(str, "%s{\"PRN\":%i,\"el\":%i,\"az\":%i,\"ss\":%i,\"used\":%s}",
+				j ? "," : "", fix->sats[j].prn, fix->sats[j].elv, fix->sats[j].azm,
+				fix->sats[j].snr < 0 ? 0 : fix->sats[j].snr, used ? "true" : "false");
+	}
+	str += sprintf(str, "]}\r\n");
+	report_put(lastsky);
+	lastsky = report_new(buf, str - buf);
+	gpsd_broadcast(lastsky);
+}
+
+/* called for each committed fix,
+ * an epoch is complete when the next one starts,
+ * or when the input is silent for GPSD_FLUSH
+ */
+static void gpsd_fix(int dirty)
+{
+	if (lastfix.tod != gpsdtod && gpsddirty) {
+		gpsd_encode_epoch();
+		gpsddirty = 0;
+	}
+	gpsddirty |= dirty;
+	/* the satellite table is only copied when it changed */
+	memcpy(&gpsdfix, &lastfix, (dirty & FIX_SATS) ? sizeof(gpsdfix) : offsetof(struct nmeashm_fix, sats));
+	gpsdtod = lastfix.tod;
+}
+
+static void gpsd_flush(void)
+{
+	if (!gpsddirty)
+		return;
+	gpsd_encode_epoch();
+	gpsddirty = 0;
+}
+
+static void gpsd_command(int idx, char *cmd)
+{
+	struct gpsdclient *gc = gclients[idx];
+
+	if (!strncmp(cmd, "?WATCH", 6)) {
+		gc->watch = !strstr(cmd, "\"enable\":false");
+		gpsd_reply(idx, "{\"class\":\"DEVICES\",\"devices\":[{\"class\":\"DEVICE\",\"path\":\"%s\",\"driver\":\"NMEA0183\"}]}\r\n",
+				gpsd_device());
+		gpsd_reply(idx, "{\"class\":\"WATCH\",\"enable\":%s,\"json\":true}\r\n",
+				gc->watch ? "true" : "false");
+	} else if (!strncmp(cmd, "?POLL", 5)) {
+		/* the reports without their \r\n */
+		gpsd_reply(idx, "{\"class\":\"POLL\",\"active\":%i,\"tpv\":[%.*s],\"sky\":[%.*s]}\r\n",
+				!!lasttpv,
+				lasttpv ? lasttpv->len-2 : 0, lasttpv ? lasttpv->dat : "",
+				lastsky ? lastsky->len-2 : 0, lastsky ? lastsky->dat : "");
+	} else if (!strncmp(cmd, "?DEVICES", 8)) {
+		gpsd_reply(idx, "{\"class\":\"DEVICES\",\"devices\":[{\"class\":\"DEVICE\",\"path\":\"%s\",\"driver\":\"NMEA0183\"}]}\r\n",
+				gpsd_device());
+	} else if (!strncmp(cmd, "?VERSION", 8)) {
+		gpsd_reply(idx, "{\"class\":\"VERSION\",\"release\":\"%s\",\"rev\":\"%s\",\"proto_major\":3,\"proto_minor\":11}\r\n",
+				VERSION, VERSION);
+	} else if (*cmd) {
+		if (strlen(cmd) > 32)
+			cmd[32] = 0;
+		gpsd_reply(idx, "{\"class\":\"ERROR\",\"message\":\"Unrecognized request '%s'\"}\r\n", json_esc(cmd));
+	}
+}
+
+static void gpsd_recv(int idx)
+{
+	struct gpsdclient *gc = gclients[idx];
+	char *str, *end;
+	int ret;
+
+	ret = read(gc->fd, gc->rx + gc->rxlen, sizeof(gc->rx) - 1 - gc->rxlen);
+	if (ret < 0 && errno == EAGAIN)
+		return;
+	if (ret <= 0) {
+		gpsd_close(idx);
+		return;
+	}
+	gc->rxlen += ret;
+	gc->rx[gc->rxlen] = 0;
+	/* commands end with ';' or newline */
+	for (str = gc->rx; (end = strpbrk(str, ";\r\n")); str = end+1) {
+		*end = 0;
+		gpsd_command(idx, str);
+	}
+	gc->rxlen -= str - gc->rx;
+	memmove(gc->rx, str, gc->rxlen);
+	if (gc->rxlen >= sizeof(gc->rx) - 1)
+		/* garbage */
+		gc->rxlen = 0;
+	gpsd_send(idx);
+}
+
+static void gpsd_accept(void)
+{
+	struct gpsdclient *gc;
+	int fd, idx;
+
+	for (;;) {
+		fd = accept4(gpsdfd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0 && (errno == EAGAIN || errno == EINTR))
+			return;
+		if (fd < 0) {
+			mylog(LOG_WARNING, "accept gpsd: %s", ESTR(errno));
+			return;
+		}
+		for (idx = 0; idx < sgclients; ++idx) {
+			if (!gclients[idx])
+				break;
+		}
+		if (idx >= sgclients) {
+			sgclients += 16;
+			gclients = realloc(gclients, sgclients * sizeof(*gclients));
+			if (!gclients)
+				mylog(LOG_ERR | LOG_EXIT, "realloc %i gpsd clients: %s", sgclients, ESTR(errno));
+			memset(gclients+idx, 0, 16 * sizeof(*gclients));
+		}
+		gc = gclients[idx] = calloc(1, sizeof(*gc));
+		if (!gc)
+			mylog(LOG_ERR | LOG_EXIT, "calloc gpsd client: %s", ESTR(errno));
+		gc->fd = fd;
+		gc->events = EPOLLIN;
+		if (ev_add(fd, EPOLLIN, EV_GPSD | idx << 8) < 0)
+			mylog(LOG_ERR | LOG_EXIT, "epoll_ctl add gpsd client: %s", ESTR(errno));
+		++ngclients;
+		gpsd_reply(idx, "{\"class\":\"VERSION\",\"release\":\"%s\",\"rev\":\"%s\",\"proto_major\":3,\"proto_minor\":11}\r\n",
+				VERSION, VERSION);
+		gpsd_send(idx);
+	}
+}
+
+/* listen on a unix socket PATH, or on [HOST:]PORT */
+static void gpsd_listen(void)
+{
+	char *host, *port;
+	struct addrinfo hints = {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_STREAM,
+		.ai_flags = AI_PASSIVE,
+	}, *ai, *res;
+	struct sockaddr_un sun = {
+		.sun_family = AF_UNIX,
+	};
+	int ret, one = 1;
+
+	if (strchr(gpsdaddr, '/')) {
+		strncpy(sun.sun_path, gpsdaddr, sizeof(sun.sun_path)-1);
+		unlink(gpsdaddr);
+		gpsdfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (gpsdfd < 0)
+			mylog(LOG_ERR | LOG_EXIT, "socket unix: %s", ESTR(errno));
+		if (bind(gpsdfd, (void *)&sun, sizeof(sun)) < 0)
+			mylog(LOG_ERR | LOG_EXIT, "bind %s: %s", gpsdaddr, ESTR(errno));
+	} else {
+		host = strdup(gpsdaddr);
+		port = strrchr(host, ':');
+		if (port)
+			*port++ = 0;
+		else {
+			port = host;
+			host = NULL;
+		}
+		ret = getaddrinfo(host && *host ? host : NULL, port, &hints, &res);
+		if (ret)
+			mylog(LOG_ERR | LOG_EXIT, "getaddrinfo %s: %s", gpsdaddr, gai_strerror(ret));
+		for (ai = res; ai; ai = ai->ai_next) {
+			gpsdfd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+			if (gpsdfd < 0)
+				continue;
+			setsockopt(gpsdfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+			if (bind(gpsdfd, ai->ai_addr, ai->ai_addrlen) >= 0)
+				break;
+			close(gpsdfd);
+			gpsdfd = -1;
 		}
+		freeaddrinfo(res);
+		if (gpsdfd < 0)
+			mylog(LOG_ERR | LOG_EXIT, "bind %s: %s", gpsdaddr, ESTR(errno));
 	}
-	/* sats-in-use */
-	int satuse = strtoul(nmea_safe_tok(NULL), NULL, 10);
-	publish_topicr("satuse", FL_RETAIN | FL_IGN_DEF_TALKER, "%i", satuse);
-	satuse_updated(talker, satuse);
-	/* hdop */
-	dval = nmea_strtod(nmea_safe_tok(NULL));
-	if (nmea_use_msg("GSA"))
-		/* publish hdop from GGA only if GSA is not used */
-		publish_topic("hdop", "%.1lf", dval);
-	/* altitude */
-	publish_topic("alt", "%.1lf", nmea_strtod(nmea_safe_tok(NULL)));
-	/* unknown */
-	nmea_tok(NULL);
-	/* geoidal seperation */
-	publish_topic("geoid", "%.1lf", nmea_strtod(nmea_safe_tok(NULL)));
-	if (!strcasecmp(msg+2, "GGA"))
-		/* M for meters */
-		nmea_tok(NULL);
-	/* differential data
-	 */
-	publish_topic("diff/age", "%s", nmea_safe_tok(NULL));
-	publish_topic("diff/id", "%s", nmea_safe_tok(NULL));
+	if (listen(gpsdfd, 16) < 0)
+		mylog(LOG_ERR | LOG_EXIT, "listen %s: %s", gpsdaddr, ESTR(errno));
+	if (ev_add(gpsdfd, EPOLLIN, EV_GPSD_LISTEN) < 0)
+		mylog(LOG_ERR | LOG_EXIT, "epoll_ctl add gpsd: %s", ESTR(errno));
 }
 
-static void recvd_gsa(void)
-{
-	int j, ival, pktnr;
-	double pdop, hdop, vdop;
+/* network gateway
+ * Many trackers send NMEA over UDP or TCP.
+ * Each source owns a parser context (topic cache, satellites, prefix),
+ * that is swapped into the globals while parsing its data.
+ * Workers are forked processes with their own SO_REUSEPORT socket,
+ * so the kernel shards the peers by a hash of their address,
+ * and each worker owns its sources without locking.
+ */
+#define GW_MAXSOCKS	4
+static const char *gwaddrs[GW_MAXSOCKS];
+static int ngwaddrs;
+static int gwworkers = 1;
+static int gwworker;
+/* the sources' topics go under <gwprefix><id>/ */
+static const char *gwprefix;
+/* identify sources by address, or by the 1st field of this sentence */
+static const char *gwidsentence;
+
+/* the swappable parser state */
+struct ctx {
+	struct topic *topics, *lasttopic;
+	struct topic *wtopics, *lastwtopic;
+	struct gsv *gsvs;
+	int ngsvs, sgsvs;
+	struct sat *sats;
+	int ssats;
+	const char *topicprefix;
+	int topicprefixlen;
+	double epoch_tod;
+	long utcday;
+	double utctod;
+	int gn_satuse_emitted;
+	struct track track;
+	struct geostate geo;
+	struct broker *broker;
+};
 
-	/* selection mode */
-	nmea_tok(NULL);
-	/* gps mode (no fix, 2D, 3D) */
-	ival = strtoul(nmea_safe_tok(NULL), NULL, 10);
-	/* consume 12 satellites */
-	for (j = 0; j < 12; ++j)
-		nmea_tok(NULL);
-	/* pdop, ... */
-	pdop = nmea_strtod(nmea_safe_tok(NULL));
-	hdop = nmea_strtod(nmea_safe_tok(NULL));
-	vdop = nmea_strtod(nmea_safe_tok(NULL));
-
-	pktnr = strtoul(nmea_tok(NULL) ?: "1", NULL, 10);
-	if (pktnr == 1) {
-		/* only print on first packet */
-		publish_topic("mode", "%s", fromtable(strmode, ival) ?: "");
-		publish_topic("pdop", "%.1lf", pdop);
-		publish_topic("hdop", "%.1lf", hdop);
-		publish_topic("vdop", "%.1lf", vdop);
-	}
+#define SWAP(a, b) do { typeof(a) _tmp = (a); (a) = (b); (b) = _tmp; } while (0)
+static void ctx_swap(struct ctx *ctx)
+{
+	SWAP(ctx->topics, topics);
+	SWAP(ctx->lasttopic, lasttopic);
+	SWAP(ctx->wtopics, wtopics);
+	SWAP(ctx->lastwtopic, lastwtopic);
+	SWAP(ctx->gsvs, gsvs);
+	SWAP(ctx->ngsvs, ngsvs);
+	SWAP(ctx->sgsvs, sgsvs);
+	SWAP(ctx->sats, sats);
+	SWAP(ctx->ssats, ssats);
+	SWAP(ctx->topicprefix, topicprefix);
+	SWAP(ctx->topicprefixlen, topicprefixlen);
+	SWAP(ctx->epoch_tod, epoch_tod);
+	SWAP(ctx->utcday, utcday);
+	SWAP(ctx->utctod, utctod);
+	SWAP(ctx->gn_satuse_emitted, gn_satuse_emitted);
+	SWAP(ctx->track, track);
+	SWAP(ctx->geo, geo);
+	SWAP(ctx->broker, curbroker);
 }
 
-/* GSV: keep track of satellites */
-struct sat {
-	int snr;
-	int elv;
-	int azm;
-	int8_t recvd; /* recvd from NMEA */
-	int8_t sent; /* sent to MQTT */
+struct source {
+	struct source *next, *hnext;
+	char *id;
+	int alive;
+	/* msec, CLOCK_MONOTONIC */
+	int64_t lastrx;
+	/* peers identified as this source */
+	int npeers;
+	struct ctx ctx;
 };
-static struct sat *sats;
-static int ssats;
-/* range of sat. ids:
- * 1..32: GPS
- * 33..54: SBAS
- * 64..88/96: GLONASS
- * 193..195: QZSS
- * 201..235: Beidou
- * 301..336: Galileo
- */
 
-struct gsv {
-	char talker[3];
-	int satmin, satmax;
-	int satview;
-	int sattrack, sattrack_saved;
-	int satuse;
-	int new;
-	time_t trecvd;
+/* a UDP sender or a TCP connection */
+struct peer {
+	struct peer *hnext;
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	/* TCP only */
+	int fd;
+	/* NULL until identified */
+	struct source *src;
+	/* UDP only, msec, CLOCK_MONOTONIC */
+	int64_t lastrx;
+	struct input in;
 };
 
-static struct gsv *gsvs;
-static int ngsvs, sgsvs;
+#define GW_HASH	4096
+/* bound the memory that random senders can claim */
+#define GW_MAXPEERS	16384
+#define GW_MAXSOURCES	16384
+/* forget idle UDP peers and dead sources, msec */
+#define GW_EXPIRE	(15 * 60 * 1000)
+static struct source *sources, *srchash[GW_HASH];
+static struct peer *peerhash[GW_HASH];
+static struct peer **gwpeers;
+static int sgwpeers;
+static int gwfds[GW_MAXSOCKS];
+static int gwudp[GW_MAXSOCKS];
+static unsigned long nsources, npeers, gwdatagrams;
+/* the source swapped in */
+static struct source *cursrc;
+
+static unsigned int gw_hash(const void *vdat, int len)
+{
+	const uint8_t *dat = vdat;
+	unsigned int hash = 2166136261u;
 
-static void clear_sat(const char *talker, int prn);
+	for (; len > 0; --len, ++dat)
+		hash = (hash ^ *dat) * 16777619u;
+	return hash % GW_HASH;
+}
 
-static struct gsv *find_gsv(const char *talker)
+static int64_t gw_now(void)
 {
-	struct gsv *gsv, *gsvend;
+	struct timespec ts;
 
-	gsvend = gsvs+ngsvs;
-	for (gsv = gsvs; gsv < gsvend; ++gsv) {
-		if (!strcmp(talker, gsv->talker))
-			break;
-	}
-	if (gsv >= gsvend) {
-		if (ngsvs >= sgsvs) {
-			sgsvs += 16;
-			gsvs = realloc(gsvs, sgsvs*sizeof(*gsvs));
-			if (!gsvs)
-				mylog(LOG_ERR | LOG_EXIT, "realloc %u gsvs: %s", sgsvs, ESTR(errno));
-		}
-		gsv = gsvs+ngsvs++;
-		/* init new gsv struct */
-		memset(gsv, 0, sizeof(*gsv));
-		strcpy(gsv->talker, talker);
-		gsv->new = 1;
-	}
-	return gsv;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
 }
 
-static void satuse_updated(const char *talker, int satuse)
+static struct source *get_source(const char *rawid)
 {
-	struct gsv *gsv;
-	int j, gn_satuse;
-	static int gn_satuse_emitted;
-
-	if (!strcmp(talker ?: "", "gn")) {
-		gn_satuse_emitted = 1;
-		/* ignore "GN", I'm aggregating it */
-		return;
+	struct source *src;
+	unsigned int idx;
+	char id[64], *str;
+
+	strncpy(id, rawid, sizeof(id)-1);
+	id[sizeof(id)-1] = 0;
+	/* MQTT wildcards & levels are no part of an id */
+	for (str = id; *str; ++str) {
+		if (strchr("/+#", *str))
+			*str = '_';
 	}
-	if (gn_satuse_emitted)
-		/* device emit's satuse already */
-		return;
-
-	gsv = find_gsv(talker);
+	idx = gw_hash(id, strlen(id));
+	for (src = srchash[idx]; src; src = src->hnext) {
+		if (!strcmp(src->id, id))
+			return src;
+	}
+	if (nsources >= GW_MAXSOURCES) {
+		mylog(LOG_WARNING, "max %i sources, %s refused", GW_MAXSOURCES, id);
+		return NULL;
+	}
+	src = calloc(1, sizeof(*src));
+	if (!src)
+		mylog(LOG_ERR | LOG_EXIT, "calloc source: %s", ESTR(errno));
+	src->id = strdup(id);
+	asprintf((char **)&src->ctx.topicprefix, "%s%s/", gwprefix, src->id);
+	src->ctx.topicprefixlen = strlen(src->ctx.topicprefix);
+	src->ctx.epoch_tod = NAN;
+	src->ctx.utcday = -1;
+	src->ctx.utctod = NAN;
+	src->ctx.geo.tod = NAN;
+	src->ctx.broker = broker_for(src->ctx.topicprefix);
+	src->hnext = srchash[idx];
+	srchash[idx] = src;
+	src->next = sources;
+	sources = src;
+	++nsources;
+	mylog(LOG_INFO, "new source %s", src->id);
+	return src;
+}
 
-	if (always || gsv->satuse != satuse) {
-		gsv->satuse = satuse;
-		/* redo gn/satuse */
-		gn_satuse = 0;
-		for (j = 0; j < ngsvs; ++j)
-			gn_satuse += gsvs[j].satuse;
-		publish_topicrt("gn", "satuse", FL_RETAIN | FL_IGN_DEF_TALKER, "%i", gn_satuse);
+static void source_enter(struct source *src)
+{
+	ctx_swap(&src->ctx);
+	cursrc = src;
+	src->lastrx = gw_now();
+	if (!src->alive) {
+		src->alive = 1;
+		publish_topicrt(NULL, "alive", FL_RETAIN, "1");
+		flush_pending_topics();
 	}
 }
 
-static void recvd_gsv(void)
+static void gw_enter(struct peer *peer)
 {
-	__attribute__((unused))
-	int msgcnt, msgidx;
-	int nsat;
-	int prn, elv, azm, snr;
-	int j;
-	char *tok;
-	struct gsv *gsv;
-	struct sat *sat;
+	curpeer = peer;
+	curinput = selected = &peer->in;
+	if (peer->src)
+		source_enter(peer->src);
+}
 
-	gsv = find_gsv(talker);
+static void gw_leave(void)
+{
+	if (cursrc)
+		ctx_swap(&cursrc->ctx);
+	cursrc = NULL;
+	curpeer = NULL;
+	curinput = selected = inputs;
+}
 
-	msgcnt = strtoul(nmea_safe_tok(NULL), NULL, 10);
-	msgidx = strtoul(nmea_safe_tok(NULL), NULL, 10);
-	nsat = strtoul(nmea_safe_tok(NULL), NULL, 10); /* #sats in view */
+static const char *peer_addr(const struct peer *peer, int withport)
+{
+	static char str[128];
+	char host[64], port[16];
+
+	if (getnameinfo((const void *)&peer->addr, peer->addrlen, host, sizeof(host),
+				port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV))
+		return "?";
+	if (withport)
+		snprintf(str, sizeof(str), "%s:%s", host, port);
+	else
+		snprintf(str, sizeof(str), "%s", host);
+	return str;
+}
 
-	gsv->trecvd = time(NULL);
-	if (msgidx == 1) {
-		/* start of block */
-		for (j = gsv->satmin; j <= gsv->satmax && j < ssats; ++j)
-			sats[j].recvd = 0;
-		gsv->sattrack = 0;
+/* called from recvd_line, return 0 to drop the sentence */
+static int peer_identify(struct peer *peer, const char *tok)
+{
+	if (peer->src) {
+		if (gwidsentence && !strcmp(tok, gwidsentence))
+			/* repeated id */
+			return 0;
+		return 1;
 	}
+	if (!gwidsentence) {
+		/* UDP senders keep their port, TCP reconnects don't */
+		peer->src = get_source(peer_addr(peer, peer->fd < 0));
+	} else if (!strcmp(tok, gwidsentence)) {
+		tok = nmea_tok(NULL);
+		if (!tok || !*tok)
+			return 0;
+		peer->src = get_source(tok);
+	} else
+		return 0;
+	if (!peer->src)
+		return 0;
+	++peer->src->npeers;
+	source_enter(peer->src);
+	publish_topicrt(NULL, "src", FL_RETAIN, "%s", peer_addr(peer, 1));
+	return !gwidsentence;
+}
 
-	for (j = 0; j < 4; ++j) {
-		tok = nmea_safe_tok(NULL);
-		if (!strlen(tok))
-			break;
-		prn = strtoul(tok, NULL, 10);
-		elv = strtoul(nmea_safe_tok(NULL), NULL, 10);
-		azm = strtoul(nmea_safe_tok(NULL), NULL, 10);
-		snr = strtoul(nmea_tok(NULL) ?: "-1", NULL, 10);
-
-		if (prn > ssats) {
-			int oldssats = ssats;
-			ssats = ssats ? ((prn + 127) & ~127) : 128;
-			sats = realloc(sats, sizeof(*sats)*ssats);
-			if (!sats)
-				mylog(LOG_ERR | LOG_EXIT, "realloc %i sats: %s", ssats, ESTR(errno));
-			memset(sats+oldssats, 0, sizeof(*sats)*(ssats - oldssats));
-		}
-
-		sat = sats+prn;
+static struct peer *peer_new(const struct sockaddr_storage *addr, socklen_t addrlen, int fd)
+{
+	struct peer *peer;
+
+	peer = calloc(1, sizeof(*peer));
+	if (!peer)
+		mylog(LOG_ERR | LOG_EXIT, "calloc peer: %s", ESTR(errno));
+	memcpy(&peer->addr, addr, addrlen);
+	peer->addrlen = addrlen;
+	peer->fd = fd;
+	peer->in.name = strdup(peer_addr(peer, 1));
+	peer->in.fd = fd;
+	++npeers;
+	return peer;
+}
 
-		/* publish satellite info non-retained.
-		 * retained messages should be cleaned up,
-		 * which implies that we must listen to our own sat info
-		 * an remove 'lost' satellites ...
-		 */
-#define GSV_FLAGS	(FL_RETAIN | FL_NO_CACHE | FL_IGN_DEF_TALKER)
-		if (always || !sat->sent || elv != sat->elv)
-			publish_topicr(mktopic("sat/%i/elv", prn), GSV_FLAGS, "%i", elv);
-		if (always || !sat->sent || azm != sat->azm)
-			publish_topicr(mktopic("sat/%i/azm", prn), GSV_FLAGS, "%i", azm);
-		if (always || !sat->sent || snr != sat->snr)
-			publish_topicr(mktopic("sat/%i/snr", prn), GSV_FLAGS, (snr < 0) ? "" : "%i", snr);
-		sat->elv = elv;
-		sat->azm = azm;
-		sat->snr = snr;
-		sat->recvd = 1;
-		sat->sent = 1;
+static void peer_free(struct peer *peer)
+{
+	if (peer->src)
+		--peer->src->npeers;
+	free(peer->in.buf);
+	free((void *)peer->in.name);
+	free(peer);
+	--npeers;
+}
 
-		/* count nr. of really recvd sats */
-		if (sat->snr >= 0)
-			++gsv->sattrack;
+/* source went silent or disconnected */
+static void source_dead(struct source *src)
+{
+	ctx_swap(&src->ctx);
+	src->alive = 0;
+	publish_topicrt(NULL, "alive", FL_RETAIN, "0");
+	erase_topics(0);
+	ctx_swap(&src->ctx);
+}
 
-		/* keep track of min/max prn of a talker */
-		if (prn < gsv->satmin || !gsv->satmax)
-			gsv->satmin = prn;
-		if (prn > gsv->satmax)
-			gsv->satmax = prn;
+static void gw_udp_recv(int fd)
+{
+	static char bufs[32][8192];
+	static struct sockaddr_storage addrs[32];
+	static struct iovec iovs[32];
+	static struct mmsghdr msgs[32];
+	struct peer *peer;
+	unsigned int idx;
+	int j, n, loops, isnew;
+	int64_t now;
+
+	for (loops = 0; loops < 8; ++loops) {
+		for (j = 0; j < 32; ++j) {
+			iovs[j].iov_base = bufs[j];
+			/* room for a newline */
+			iovs[j].iov_len = sizeof(bufs[j]) - 1;
+			msgs[j].msg_hdr = (struct msghdr){
+				.msg_name = &addrs[j],
+				.msg_namelen = sizeof(addrs[j]),
+				.msg_iov = &iovs[j],
+				.msg_iovlen = 1,
+			};
+		}
+		n = recvmmsg(fd, msgs, 32, MSG_DONTWAIT, NULL);
+		if (n < 0 && (errno == EAGAIN || errno == EINTR))
+			break;
+		if (n < 0)
+			mylog(LOG_ERR | LOG_EXIT, "recvmmsg: %s", ESTR(errno));
+		gwdatagrams += n;
+		now = gw_now();
+		for (j = 0; j < n; ++j) {
+			idx = gw_hash(&addrs[j], msgs[j].msg_hdr.msg_namelen);
+			for (peer = peerhash[idx]; peer; peer = peer->hnext) {
+				if (peer->addrlen == msgs[j].msg_hdr.msg_namelen &&
+						!memcmp(&peer->addr, &addrs[j], peer->addrlen))
+					break;
+			}
+			isnew = !peer;
+			if (isnew && npeers >= GW_MAXPEERS)
+				continue;
+			if (isnew)
+				peer = peer_new(&addrs[j], msgs[j].msg_hdr.msg_namelen, -1);
+			if (peer != curpeer) {
+				gw_leave();
+				gw_enter(peer);
+			}
+			peer->lastrx = now;
+			/* a datagram holds complete sentences */
+			if (msgs[j].msg_len && bufs[j][msgs[j].msg_len-1] != '\n')
+				bufs[j][msgs[j].msg_len++] = '\n';
+			recvd_data(bufs[j], msgs[j].msg_len);
+			if (!isnew)
+				continue;
+			if (peer->src) {
+				/* keep only peers that sent a valid sentence */
+				peer->hnext = peerhash[idx];
+				peerhash[idx] = peer;
+				continue;
+			}
+			gw_leave();
+			peer_free(peer);
+		}
+		gw_leave();
+		if (n < 32)
+			break;
 	}
-	if (msgidx == msgcnt) {
-		for (j = gsv->satmin; j < gsv->satmax; ++j)
-			if (sats[j].sent && !sats[j].recvd)
-				clear_sat(talker, j);
-		/* emit number of sats in view
-		 * not to confuse with 'satvis' which is actually 'satinuse'
-		 * This can also act as a terminator of the satellite list
-		 */
-		if (always || gsv->new || nsat != gsv->satview)
-			/* do not cache, it serves to terminate the block */
-			publish_topicr("satview", FL_IGN_DEF_TALKER, "%i", nsat);
-		gsv->satview = nsat;
-		if (always || gsv->new || gsv->sattrack != gsv->sattrack_saved)
-			publish_topicr("sattrack", FL_IGN_DEF_TALKER, "%i", gsv->sattrack);
-		gsv->sattrack_saved = gsv->sattrack;
-		gsv->new = 0;
+}
 
-		int satview = 0;
-		int sattrack = 0;
-		for (j = 0; j < ngsvs; ++j) {
-			satview += gsvs[j].satview;
-			sattrack += gsvs[j].sattrack_saved;
+static void gw_accept(int lfd)
+{
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	int fd, idx;
+
+	for (;;) {
+		addrlen = sizeof(addr);
+		fd = accept4(lfd, (void *)&addr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0 && (errno == EAGAIN || errno == EINTR))
+			return;
+		if (fd < 0) {
+			mylog(LOG_WARNING, "accept: %s", ESTR(errno));
+			return;
 		}
-		publish_topicrt("gn", "satview", FL_RETAIN | FL_IGN_DEF_TALKER, "%i", satview);
-		publish_topicrt("gn", "sattrack", FL_RETAIN | FL_IGN_DEF_TALKER, "%i", sattrack);
+		if (npeers >= GW_MAXPEERS) {
+			mylog(LOG_WARNING, "max %i peers, connection refused", GW_MAXPEERS);
+			close(fd);
+			continue;
+		}
+		for (idx = 0; idx < sgwpeers; ++idx) {
+			if (!gwpeers[idx])
+				break;
+		}
+		if (idx >= sgwpeers) {
+			sgwpeers += 64;
+			gwpeers = realloc(gwpeers, sgwpeers * sizeof(*gwpeers));
+			if (!gwpeers)
+				mylog(LOG_ERR | LOG_EXIT, "realloc %i peers: %s", sgwpeers, ESTR(errno));
+			memset(gwpeers+idx, 0, 64 * sizeof(*gwpeers));
+		}
+		gwpeers[idx] = peer_new(&addr, addrlen, fd);
+		if (ev_add(fd, EPOLLIN, EV_GW_PEER | idx << 8) < 0)
+			mylog(LOG_ERR | LOG_EXIT, "epoll_ctl add peer: %s", ESTR(errno));
 	}
 }
 
-static void clear_sat(const char *talker, int prn)
+static void gw_peer_recv(int idx)
 {
-	if (prn >= ssats)
+	struct peer *peer = gwpeers[idx];
+	static char buf[16384];
+	ssize_t ret;
+
+	ret = read(peer->fd, buf, sizeof(buf));
+	if (ret < 0 && errno == EAGAIN)
+		return;
+	if (ret > 0) {
+		gw_enter(peer);
+		recvd_data(buf, ret);
+		gw_leave();
 		return;
-	if (sats[prn].sent) {
-		/* remove retained msgs */
-		publish_topicrt(talker, mktopic("sat/%i/elv", prn), GSV_FLAGS, NULL);
-		publish_topicrt(talker, mktopic("sat/%i/azm", prn), GSV_FLAGS, NULL);
-		publish_topicrt(talker, mktopic("sat/%i/snr", prn), GSV_FLAGS, NULL);
 	}
-	memset(&sats[prn], 0, sizeof(sats[prn]));
+	/* the source context stays until gw_sweep expires it */
+	mylog(LOG_INFO, "%s: %s", peer->in.name, ret ? ESTR(errno) : "closed");
+	if (peer->src && peer->src->alive)
+		source_dead(peer->src);
+	close(peer->fd);
+	peer_free(peer);
+	gwpeers[idx] = NULL;
 }
 
-static void clear_gsvs(void)
+/* clear a source, and forget it */
+static void source_free(struct source *src)
 {
-	int j, k;
-	struct gsv *gsv;
+	unsigned int idx;
+	struct source **psrc;
 
-	for (j = 0, gsv = gsvs; j < ngsvs; ++j, ++gsv) {
-		for (k = gsv->satmin; k <= gsv->satmax; ++k)
-			clear_sat(gsv->talker, k);
-		publish_topicrt(gsv->talker, "satview", GSV_FLAGS, NULL);
-		publish_topicrt(gsv->talker, "sattrack", GSV_FLAGS, NULL);
-		gsv->satview = 0;
-		gsv->sattrack = 0;
-		gsv->sattrack_saved = 0;
+	mylog(LOG_INFO, "source %s expired", src->id);
+	ctx_swap(&src->ctx);
+	erase_topics(1);
+	clear_gsvs();
+	free_topics();
+	free(geo.in);
+	ctx_swap(&src->ctx);
+
+	idx = gw_hash(src->id, strlen(src->id));
+	for (psrc = &srchash[idx]; *psrc != src; psrc = &(*psrc)->hnext);
+	*psrc = src->hnext;
+	for (psrc = &sources; *psrc != src; psrc = &(*psrc)->next);
+	*psrc = src->next;
+	free(src->id);
+	free((void *)src->ctx.topicprefix);
+	free(src);
+	--nsources;
+}
+
+/* clear the sources that went silent, expire idle peers & sources */
+static void gw_sweep(void)
+{
+	struct source *src, *next;
+	struct peer **ppeer, *peer;
+	int64_t now = gw_now();
+	int j;
+
+	for (j = 0; j < GW_HASH; ++j) {
+		for (ppeer = &peerhash[j]; *ppeer; ) {
+			peer = *ppeer;
+			if (now - peer->lastrx <= GW_EXPIRE) {
+				ppeer = &peer->hnext;
+				continue;
+			}
+			*ppeer = peer->hnext;
+			peer_free(peer);
+		}
+	}
+	for (src = sources; src; src = next) {
+		next = src->next;
+		if (src->alive && now - src->lastrx > deadtime)
+			source_dead(src);
+		else if (!src->alive && !src->npeers && now - src->lastrx > GW_EXPIRE)
+			source_free(src);
 	}
-	ngsvs = 0;
-	sgsvs = 0;
-	ssats = 0;
-	if (sats)
-		free(sats);
-	sats = NULL;
-	if (gsvs)
-		free(gsvs);
-	gsvs = NULL;
 }
 
-static void recvd_txt(void)
+/* [udp:|tcp:][HOST:]PORT */
+static int gw_socket(const char *addr, int *udp)
 {
-	int level;
-	const char *msg;
-	static const int levels[256] = {
-		[0] = LOG_ERR,
-		[1] = LOG_WARNING,
-		[2] = LOG_NOTICE,
-		[7] = LOG_INFO,
-	};
+	char *host, *port;
+	struct addrinfo hints = {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_DGRAM,
+		.ai_flags = AI_PASSIVE,
+	}, *ai, *res;
+	int fd = -1, ret, one = 1;
+
+	host = strdup(addr);
+	if (!strncmp(host, "tcp:", 4)) {
+		hints.ai_socktype = SOCK_STREAM;
+		host += 4;
+	} else if (!strncmp(host, "udp:", 4))
+		host += 4;
+	port = strrchr(host, ':');
+	if (port)
+		*port++ = 0;
+	else {
+		port = host;
+		host = NULL;
+	}
+	ret = getaddrinfo(host && *host ? host : NULL, port, &hints, &res);
+	if (ret)
+		mylog(LOG_ERR | LOG_EXIT, "getaddrinfo %s: %s", addr, gai_strerror(ret));
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		/* let the kernel spread the peers over the workers */
+		setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+		if (bind(fd, ai->ai_addr, ai->ai_addrlen) >= 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	if (fd < 0)
+		mylog(LOG_ERR | LOG_EXIT, "bind %s: %s", addr, ESTR(errno));
+	*udp = hints.ai_socktype == SOCK_DGRAM;
+	if (*udp) {
+		int size = 4 << 20;
+
+		/* absorb bursts of many trackers */
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	} else if (listen(fd, 128) < 0)
+		mylog(LOG_ERR | LOG_EXIT, "listen %s: %s", addr, ESTR(errno));
+	return fd;
+}
 
-	nmea_tok(NULL);
-	nmea_tok(NULL);
+static void gw_listen(void)
+{
+	int j;
 
-	level = strtoul(nmea_safe_tok(NULL), NULL, 10);
-	msg = nmea_tok(NULL);
+	for (j = 0; j < ngwaddrs; ++j) {
+		gwfds[j] = gw_socket(gwaddrs[j], &gwudp[j]);
+		if (ev_add(gwfds[j], EPOLLIN, (gwudp[j] ? EV_GW_UDP : EV_GW_LISTEN) | j << 8) < 0)
+			mylog(LOG_ERR | LOG_EXIT, "epoll_ctl add %s: %s", gwaddrs[j], ESTR(errno));
+	}
+}
 
-	if (levels[level] && msg)
-		mylog(levels[level], "%s %c%cTXT '%s'", file, toupper(talker[0]), toupper(talker[1]), msg);
+static void peer_stats(struct peer *peer)
+{
+	if (!peer->src)
+		return;
+	ctx_swap(&peer->src->ctx);
+	epoch_stats(&peer->in, NULL, 0);
+	ctx_swap(&peer->src->ctx);
 }
 
-static void recvd_vtg(void)
+/* publish the epoch statistics of each identified source */
+static void gw_stats(void)
 {
+	struct peer *peer;
 	int j;
 
-	/* true heading */
-	publish_topic("heading", "%.2lf", nmea_strtod(nmea_safe_tok(NULL)));
-	nmea_tok(NULL);
-	/* magnetic heading */
-	publish_topic("heading/magnetic", "%.2lf", nmea_strtod(nmea_safe_tok(NULL)));
-	for (j = 4; j < 7; ++j)
-		nmea_tok(NULL);
-	publish_topic("speed", "%.2lf", nmea_strtod(nmea_safe_tok(NULL)));
+	/* UDP peers */
+	for (j = 0; j < GW_HASH; ++j) {
+		for (peer = peerhash[j]; peer; peer = peer->hnext)
+			peer_stats(peer);
+	}
+	/* TCP peers */
+	for (j = 0; j < sgwpeers; ++j) {
+		if (gwpeers[j])
+			peer_stats(gwpeers[j]);
+	}
 }
 
-static void recvd_zda(void)
+/* move all sources to a new geofence set */
+static void gw_geofence_rebase(struct fenceset *fs)
 {
-	int val;
-	time_t tim;
-	struct tm tm = {};
+	struct source *src;
 
-	val = strtoul(nmea_safe_tok(NULL), NULL, 10);
-	tm.tm_sec = val % 100; val /= 100;
-	tm.tm_min = val % 100; val /= 100;
-	tm.tm_hour = val;
-	tm.tm_mday = strtoul(nmea_safe_tok(NULL), NULL, 10);
-	tm.tm_mon  = strtoul(nmea_safe_tok(NULL), NULL, 10) - 1;
-	tm.tm_year = strtoul(nmea_safe_tok(NULL), NULL, 10) - 1900;
+	for (src = sources; src; src = src->next) {
+		ctx_swap(&src->ctx);
+		geofence_rebase(fs);
+		ctx_swap(&src->ctx);
+	}
+}
 
-	tim = timegm(&tm);
-	publish_topic("utc", "%lu", tim);
+/* clear all sources at exit */
+static void gw_exit(void)
+{
+	struct source *src;
 
-	static char tstr[128];
-	strftime(tstr, sizeof(tstr), "%a %d %b %Y %H:%M:%S", localtime(&tim));
-	publish_topic("datetime", "%s", tstr);
+	for (src = sources; src; src = src->next) {
+		ctx_swap(&src->ctx);
+		erase_topics(1);
+		clear_gsvs();
+		ctx_swap(&src->ctx);
+	}
 }
 
-static void recvd_line(char *line)
+/* fork the workers, the parent only supervises */
+static volatile int gwsigterm;
+static void gw_onsignal(int sig)
 {
-	char *tok;
+	gwsigterm = 1;
+}
 
-	if (!*line)
-		/* empty line */
-		return;
-	if (nmea_is_valid_sentence(line) < 0)
-		return;
-	tok = nmea_tok(line);
-	if (strlen(tok) <= 2)
-		/* bad line ? */
-		return;
-	in_data_sentence = 0;
-	/* don't test the precise talker id */
-	talker[0] = tolower(tok[0]);
-	talker[1] = tolower(tok[1]);
+static void gw_fork(void)
+{
+	pid_t *pids, pid;
+	int j, status, nrunning;
+	struct sigaction sa = {
+		.sa_handler = gw_onsignal,
+	};
 
-	if (!strcmp(tok+2, "TXT"))
-		recvd_txt();
-	else if (!nmea_use_msg(tok+2))
-		/* this sentence is blocked */
-		goto done;
-	else if (!strcmp(tok+2, "GGA") || !strcmp(tok+2, "GNS"))
-		recvd_gga_gns(tok);
-	else if (!strcmp(tok+2, "GSA"))
-		recvd_gsa();
-	else if (!strcmp(tok+2, "GSV"))
-		recvd_gsv();
-	else if (!strcmp(tok+2, "VTG"))
-		recvd_vtg();
-	else if (!strcmp(tok+2, "ZDA"))
-		recvd_zda();
-	flush_pending_topics();
-done:
-	in_data_sentence = 0;
+	pids = calloc(gwworkers, sizeof(*pids));
+	if (!pids)
+		mylog(LOG_ERR | LOG_EXIT, "calloc %u workers: %s", gwworkers, ESTR(errno));
+	for (j = 0; j < gwworkers; ++j) {
+		pids[j] = fork();
+		if (pids[j] < 0)
+			mylog(LOG_ERR | LOG_EXIT, "fork: %s", ESTR(errno));
+		if (!pids[j]) {
+			free(pids);
+			gwworker = j;
+			return;
+		}
+	}
+	/* no SA_RESTART, let wait() return */
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	for (nrunning = gwworkers; nrunning; ) {
+		pid = wait(&status);
+		if (pid < 0 && errno == EINTR) {
+			for (j = 0; j < gwworkers; ++j) {
+				if (pids[j] > 0)
+					kill(pids[j], SIGTERM);
+			}
+			continue;
+		}
+		if (pid < 0)
+			mylog(LOG_ERR | LOG_EXIT, "wait: %s", ESTR(errno));
+		for (j = 0; j < gwworkers; ++j) {
+			if (pids[j] == pid)
+				pids[j] = 0;
+		}
+		--nrunning;
+		if (!gwsigterm && (!WIFEXITED(status) || WEXITSTATUS(status)))
+			mylog(LOG_WARNING, "worker %i failed", pid);
+	}
+	exit(0);
 }
 
-/* ublox */
-static uint16_t ublox_crc(const void *vdat, int len)
+static void log_stats(void)
 {
-	const uint8_t *dat = vdat;
-	uint8_t cka = 0, ckb = 0;
-
-	for (; len; ++dat, --len) {
-		cka += *dat;
-		ckb += cka;
+	struct broker *b;
+	struct input *in;
+	char sub[16];
+
+	mylog(LOG_NOTICE, "%lu sentences, %lu cache heap allocations",
+			nsentences, ncache_allocs);
+	for (b = brokers; b < brokers+nbrokers; ++b)
+		mylog(LOG_NOTICE, "mqtt %s:%i %s, %lu queued (%zu bytes), %i inflight, %lu dropped, %lu coalesced",
+				b->host, b->port, b->connected ? "connected" : "disconnected",
+				b->qlen, b->qbytes, b->ninflight, b->qdropped, b->qcoalesced);
+	if (jwr)
+		mylog(LOG_NOTICE, "journal %lu records written, %lu replayed",
+				jwritten, jreplayed);
+	if (gpsdfd >= 0)
+		mylog(LOG_NOTICE, "gpsd %i clients, %lu reports dropped",
+				ngclients, gpsd_dropped);
+	for (in = inputs; in < inputs+ninputs; ++in) {
+		sprintf(sub, "%i", (int)(in - inputs));
+		epoch_stats(in, ninputs > 1 ? sub : NULL, 1);
 	}
-	return (cka << 8) + ckb;
+	if (ngwaddrs) {
+		mylog(LOG_NOTICE, "gateway %lu sources, %lu peers, %lu datagrams",
+				nsources, npeers, gwdatagrams);
+		gw_stats();
+	}
+	if (fences)
+		mylog(LOG_NOTICE, "geofence %i fences, %lu events", fences->nfences, geoevents);
+	if (lowlatency)
+		lowlat_stats();
 }
 
-static void recvd_ublox_frame(const void *vdat, int len)
+/* batch mode: convert a regular file in parallel chunks */
+struct chunk {
+	const char *dat;
+	size_t len;
+	pid_t pid;
+	FILE *fp;
+	int done;
+};
+
+static void batch_worker(const char *dat, size_t len)
 {
-	const uint8_t *dat = vdat;
-	uint16_t f_ck, my_ck;
-	uint16_t clsid;
+	size_t pos, n;
+
+	madvise((void *)dat, len, MADV_SEQUENTIAL);
+	/* feed in pieces, so buf does not grow to the chunk size */
+	for (pos = 0; pos < len; pos += n) {
+		n = len - pos;
+		if (n > 65536)
+			n = 65536;
+		recvd_data(dat+pos, n);
+	}
+}
 
-	my_ck = ublox_crc(dat+2, len-4);
-	memcpy(&f_ck, dat+len-2, 2);
-	f_ck = be16toh(f_ck);
-	if (f_ck != my_ck) {
-		mylog(LOG_WARNING, "ublox: crc mismatch");
+static void batch_merge(struct chunk *chunk)
+{
+	char *line = NULL, *topic, *payload;
+	size_t linesize = 0;
+	ssize_t ret;
+	off_t off;
+
+	fflush(chunk->fp);
+	if (outfile) {
+		/* worker output is final, copy it */
+		fflush(outfile);
+		for (off = 0;;) {
+			ret = sendfile(fileno(outfile), fileno(chunk->fp), &off, 1 << 30);
+			if (ret < 0)
+				mylog(LOG_ERR | LOG_EXIT, "sendfile: %s", ESTR(errno));
+			if (!ret)
+				break;
+		}
 		return;
 	}
-	memcpy(&clsid, dat+2, 2);
-	/* class/id is formatted as BigEndian */
-	clsid = be16toh(clsid);
-	mylog(LOG_INFO, "ublox: %04x+%u", clsid, len-8);
+	rewind(chunk->fp);
+	while ((ret = getline(&line, &linesize, chunk->fp)) > 0) {
+		if (line[ret-1] == '\n')
+			line[ret-1] = 0;
+		topic = line+2;
+		payload = strchr(topic, ' ');
+		if (!payload)
+			continue;
+		*payload++ = 0;
+		mypublish(topic, payload, line[0] == 'r');
+		/* block instead of coalescing or dropping history */
+		while (outq_pending())
+			mqtt_service_all(100);
+	}
+	free(line);
 }
 
-/* multiplexer */
-static char *buf;
-static size_t buflen;
-static size_t bufsize;
-
-static void recvd_data(const char *line, int len)
+static void batch_run(int fd)
 {
-	char *str;
-	size_t bufpos;
+	struct stat st;
+	const char *dat, *str;
+	struct chunk *chunks, *chunk;
+	int nchunks, next, merged, running, j, status;
+	size_t pos;
+	pid_t pid;
+
+	if (fstat(fd, &st) < 0)
+		mylog(LOG_ERR | LOG_EXIT, "fstat %s: %s", file, ESTR(errno));
+	if (!S_ISREG(st.st_mode))
+		mylog(LOG_ERR | LOG_EXIT, "%s: batch mode needs a regular file", file);
+	if (!st.st_size)
+		return;
+	dat = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (dat == MAP_FAILED)
+		mylog(LOG_ERR | LOG_EXIT, "mmap %s: %s", file, ESTR(errno));
 
-	if (buflen + len + 1 > bufsize) {
-		/* grow */
-		bufsize = (buflen+len+1+1023) & ~1023;
-		buf = realloc(buf, bufsize);
-		if (!buf)
-			mylog(LOG_ERR | LOG_EXIT, "realloc");
+	/* use more chunks than jobs to balance the load,
+	 * but avoid tiny chunks
+	 */
+	nchunks = jobs*4;
+	if (nchunks > st.st_size >> 20)
+		nchunks = st.st_size >> 20;
+	if (nchunks < 1)
+		nchunks = 1;
+	chunks = calloc(nchunks, sizeof(*chunks));
+	if (!chunks)
+		mylog(LOG_ERR | LOG_EXIT, "calloc %u chunks: %s", nchunks, ESTR(errno));
+
+	/* split at sentence boundaries */
+	for (j = 0, pos = 0; j < nchunks; ++j) {
+		chunks[j].dat = dat+pos;
+		if (j+1 < nchunks) {
+			size_t end = (size_t)st.st_size*(j+1)/nchunks;
+
+			if (end < pos)
+				end = pos;
+			str = memchr(dat+end, '\n', st.st_size-end);
+			end = str ? str+1-dat : st.st_size;
+			chunks[j].len = end - pos;
+			pos = end;
+		} else
+			chunks[j].len = st.st_size - pos;
 	}
-	/* append */
-	memcpy(buf+buflen, line, len);
-	buflen += len;
-	buf[buflen] = 0; /* null terminate */
-	/* parse */
-	for (bufpos = 0;;) {
-		if (!memcmp(buf+bufpos, (uint8_t[]){ 0xb5, 0x62, }, 2)) {
-			/* ublox header */
-			uint16_t v16;
-
-			if ((buflen - bufpos) < 8)
-				/* incomplete empty ublox frame */
-				break;
-			memcpy(&v16, buf+bufpos+4, 2);
-			v16 = le16toh(v16);
-			v16 = buf[bufpos+4];
-			if ((buflen - bufpos) < (v16+8))
-				/* incomplete ublox frame */
+	mylog(LOG_INFO, "%s: %u chunks, %u jobs", file, nchunks, jobs);
+
+	for (next = merged = running = 0; merged < nchunks; ) {
+		for (; running < jobs && next < nchunks; ++next, ++running) {
+			chunk = chunks+next;
+			chunk->fp = tmpfile();
+			if (!chunk->fp)
+				mylog(LOG_ERR | LOG_EXIT, "tmpfile: %s", ESTR(errno));
+			/* avoid duplicate stdio buffers */
+			fflush(NULL);
+			chunk->pid = fork();
+			if (chunk->pid < 0)
+				mylog(LOG_ERR | LOG_EXIT, "fork: %s", ESTR(errno));
+			if (!chunk->pid) {
+				outfile_retain = !outfile;
+				outfile = chunk->fp;
+				batch_worker(chunk->dat, chunk->len);
+				fflush(outfile);
+				/* don't run atexit(), it would disconnect our parent */
+				_exit(0);
+			}
+		}
+		pid = wait(&status);
+		if (pid < 0)
+			mylog(LOG_ERR | LOG_EXIT, "wait: %s", ESTR(errno));
+		for (j = 0; j < next; ++j) {
+			if (chunks[j].pid == pid)
 				break;
-			recvd_ublox_frame(buf+bufpos, v16+8);
-			bufpos += v16+8;
+		}
+		if (j >= next)
 			continue;
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			mylog(LOG_ERR | LOG_EXIT, "%s: chunk %u failed", file, j);
+		chunks[j].done = 1;
+		--running;
+		/* merge in order */
+		for (; merged < next && chunks[merged].done; ++merged) {
+			batch_merge(chunks+merged);
+			fclose(chunks[merged].fp);
 		}
-		str = strchr(buf+bufpos, '\n');
-		if (!str)
-			break;
-		if (str > buf+bufpos && *(str-1) == '\r')
-			/* cut \r too */
-			*(str-1) = 0;
-		/* null-terminate */
-		*str++ = 0;
-		recvd_line(buf+bufpos);
-		bufpos = str-buf;
 	}
-	/* forget consumed data */
-	if (bufpos)
-		memcpy(buf, buf+bufpos, buflen-bufpos+1);
-	buflen -= bufpos;
+	free(chunks);
+	munmap((void *)dat, st.st_size);
+}
+
+static int open_input(const char *file)
+{
+	int fd;
+	struct termios term;
+
+	/* open file */
+	fd = open(file, (jobs ? O_RDONLY : O_RDWR) | O_NOCTTY | O_NONBLOCK);
+	if (fd < 0)
+		mylog(LOG_ERR | LOG_EXIT, "open %s: %s", file, ESTR(errno));
+
+	/* prepare port */
+	if (tcgetattr(fd, &term) < 0) {
+		if (errno != ENOTTY)
+			mylog(LOG_ERR | LOG_EXIT, "tcgetattr %s: %s", file, ESTR(errno));
+	} else {
+		term.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | IXON | INLCR | IGNCR | ICRNL | INPCK);
+		term.c_oflag &= ~(OPOST);
+		term.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+		if (lowlatency) {
+			struct serial_struct ser;
+
+			/* return each byte */
+			term.c_cc[VMIN] = 1;
+			term.c_cc[VTIME] = 0;
+			/* not all drivers know this */
+			if (!ioctl(fd, TIOCGSERIAL, &ser)) {
+				ser.flags |= ASYNC_LOW_LATENCY;
+				ioctl(fd, TIOCSSERIAL, &ser);
+			}
+		}
+		/* Replacing TCSAFLUSH by TCSANOW to avoid standard GPS blocked on some machines. */
+		if (tcsetattr(fd, TCSANOW, &term) < 0)
+			mylog(LOG_ERR | LOG_EXIT, "tcsetattr %s: %s", file, ESTR(errno));
+	}
+	return fd;
+}
+
+/* parse a size with optional k or M suffix */
+static size_t strtosize(const char *str, char **endp)
+{
+	char *end;
+	size_t size;
+
+	size = strtoul(str, &end, 0);
+	switch (*end) {
+	case 'k':
+	case 'K':
+		size <<= 10;
+		++end;
+		break;
+	case 'M':
+		size <<= 20;
+		++end;
+		break;
+	}
+	if (endp)
+		*endp = end;
+	return size;
 }
 
 int main(int argc, char *argv[])
 {
-	int opt, ret;
-	char *str;
+	int opt, ret, j;
+	char *str, *tok;
 	char mqtt_name[32];
+	struct broker *b;
 	int logmask = LOG_UPTO(LOG_NOTICE);
-	struct pollfd pf[3];
 
 	setlocale(LC_ALL, "");
 	/* argument parsing */
@@ -1045,12 +5562,6 @@ int main(int argc, char *argv[])
 		break;
 	case 'h':
 		mqtt_host = optarg;
-		str = strrchr(optarg, ':');
-		if (str > mqtt_host && *(str-1) != ']') {
-			/* TCP port provided */
-			*str = 0;
-			mqtt_port = strtoul(str+1, NULL, 10);
-		}
 		break;
 	case 'n':
 		optarg = strdup(optarg);
@@ -1065,11 +5576,140 @@ int main(int argc, char *argv[])
 		always = 1;
 		break;
 	case 'd':
-		deaddelay = strtoul(optarg, NULL, 0);
+		deadtime = strtod(optarg, NULL) * 1000;
 		break;
 	case 'D':
 		def_talker = optarg;
 		break;
+	case 'o':
+		if (!strcmp(optarg, "-"))
+			outfile = stdout;
+		else
+			outfile = fopen(optarg, "w");
+		if (!outfile)
+			mylog(LOG_ERR | LOG_EXIT, "fopen %s: %s", optarg, ESTR(errno));
+		break;
+	case 's':
+		for (j = 0; j < sizeof(strselect)/sizeof(strselect[0]); ++j) {
+			if (!strcmp(optarg, strselect[j]))
+				break;
+		}
+		if (j >= sizeof(strselect)/sizeof(strselect[0]))
+			mylog(LOG_ERR | LOG_EXIT, "unknown policy '%s'", optarg);
+		select_policy = j;
+		break;
+	case 'T':
+		statsinterval = strtoul(optarg, NULL, 0);
+		break;
+	case 'j':
+		jobs = strtoul(optarg, NULL, 0);
+		break;
+	case 'R':
+		resume = 1;
+		break;
+	case '5':
+#ifndef HAVE_MQTT5
+		mylog(LOG_ERR | LOG_EXIT, "MQTT v5 needs libmosquitto 1.6 or later");
+#endif
+		mqtt5 = 1;
+		break;
+	case 'e':
+		expiry = strtoul(optarg, NULL, 0);
+		break;
+	case 'q':
+		for (tok = strtok(optarg, ","); tok; tok = strtok(NULL, ",")) {
+			str = strchr(tok, '=');
+			if (str)
+				*str++ = 0;
+			for (j = 0; j < NCLASSES; ++j) {
+				if (!strcmp(tok, strclass[j]))
+					break;
+			}
+			if (!str || j >= NCLASSES)
+				mylog(LOG_ERR | LOG_EXIT, "bad qos '%s'", tok);
+			class_qos[j] = strtoul(str, NULL, 0);
+		}
+		break;
+	case 'Q':
+		qlimit = strtosize(optarg, NULL);
+		break;
+	case 'I':
+		maxinflight = strtoul(optarg, NULL, 0);
+		if (maxinflight < 1)
+			maxinflight = 1;
+		break;
+	case 'J':
+		journal = optarg;
+		str = strchr(optarg, ',');
+		if (str) {
+			*str++ = 0;
+			journal_max = strtosize(str, NULL);
+		}
+		break;
+	case 'r':
+		journal_rate = strtoul(optarg, NULL, 0);
+		break;
+	case 'S':
+		load_schema(optarg);
+		break;
+	case 'm':
+		shmname = optarg;
+		break;
+	case 'G':
+		gpsdaddr = optarg;
+		break;
+	case 'g':
+		if (ngwaddrs >= GW_MAXSOCKS)
+			mylog(LOG_ERR | LOG_EXIT, "max %i gateway addresses", GW_MAXSOCKS);
+		gwaddrs[ngwaddrs++] = optarg;
+		break;
+	case 'W':
+		gwworkers = strtoul(optarg, NULL, 0);
+		break;
+	case 'i':
+		gwidsentence = optarg;
+		break;
+	case 't':
+		throughput = 1;
+		break;
+	case 'k':
+		track_tol = strtod(optarg, NULL);
+		break;
+	case 'E':
+		derive_ecef = 1;
+		break;
+	case 'U':
+		derive_utm = 1;
+		break;
+	case 'O':
+		origin[0] = strtod(optarg, &str);
+		if (*str != ',')
+			mylog(LOG_ERR | LOG_EXIT, "bad origin '%s', use LAT,LON[,ALT]", optarg);
+		origin[1] = strtod(str+1, &str);
+		if (*str == ',')
+			origin[2] = strtod(str+1, NULL);
+		have_origin = 1;
+		origin_init();
+		break;
+	case 'P':
+		predict_hz = strtod(optarg, NULL);
+		break;
+	case 'f':
+		geofile = strdup(optarg);
+		str = strchr(geofile, ',');
+		if (str) {
+			*str++ = 0;
+			geodwell = strtod(str, NULL);
+		}
+		break;
+	case 'L':
+		lowlatency = 1;
+		if (optarg) {
+			rtprio = strtoul(optarg, &str, 0);
+			if (*str == ',')
+				rtcpu = strtoul(str+1, NULL, 0);
+		}
+		break;
 
 	default:
 		fprintf(stderr, "unknown option '%c'", opt);
@@ -1079,63 +5719,149 @@ int main(int argc, char *argv[])
 		break;
 	}
 
-	atexit(my_exit);
 	setlogmask(logmask);
+	if (throughput && lowlatency)
+		mylog(LOG_ERR | LOG_EXIT, "--throughput and --lowlatency exclude each other");
+	if (geofile) {
+		geofence_reload("");
+		if (!fences)
+			mylog(LOG_ERR | LOG_EXIT, "%s: no geofences", geofile);
+	}
+	if (ngwaddrs) {
+		if (optind < argc || jobs || journal || shmname || gpsdaddr || predict_hz > 0)
+			mylog(LOG_ERR | LOG_EXIT, "gateway mode takes no FILE, --jobs, --journal, --shm, --gpsd or --predict");
+		if (gwworkers > 1)
+			gw_fork();
+		/* the worker's own topics */
+		gwprefix = topicprefix;
+		asprintf((char **)&topicprefix, "%sgateway/%i/", gwprefix, gwworker);
+		topicprefixlen = strlen(topicprefix);
+		file = (char *)gwaddrs[0];
+		ninputs = 0;
+		heaptopicnames = 1;
+	}
+	atexit(my_exit);
 
 	if (optind < argc) {
-		/* extra file|device argument */
-		file = argv[optind++];
-		int fd;
-		struct termios term;
-
-		/* open file */
-		fd = open(file, O_RDWR | O_NOCTTY | O_NONBLOCK);
-		if (fd < 0)
-			mylog(LOG_ERR | LOG_EXIT, "open %s: %s", file, ESTR(errno));
-
-		/* prepare port */
-		if (tcgetattr(fd, &term) < 0) {
-			if (errno != ENOTTY)
-				mylog(LOG_ERR | LOG_EXIT, "tcgetattr %s: %s", file, ESTR(errno));
-		} else {
-			term.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | IXON | INLCR | IGNCR | ICRNL | INPCK);
-			term.c_oflag &= ~(OPOST);
-			term.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
-			/* Replacing TCSAFLUSH by TCSANOW to avoid standard GPS blocked on some machines. */
-			if (tcsetattr(fd, TCSANOW, &term) < 0)
-				mylog(LOG_ERR | LOG_EXIT, "tcsetattr %s: %s", file, ESTR(errno));
-		}
-		/* set file|device as stdin */
-		dup2(fd, STDIN_FILENO);
-		close(fd);
+		/* extra file|device arguments */
+		ninputs = argc - optind;
+		if (ninputs > 1) {
+			if (jobs)
+				mylog(LOG_ERR | LOG_EXIT, "batch mode takes 1 file");
+			inputs = calloc(ninputs, sizeof(*inputs));
+			if (!inputs)
+				mylog(LOG_ERR | LOG_EXIT, "calloc %u inputs: %s", ninputs, ESTR(errno));
+		}
+		for (j = 0; j < ninputs; ++j) {
+			inputs[j].name = argv[optind+j];
+			inputs[j].fd = open_input(inputs[j].name);
+		}
+		/* set the primary file|device as stdin */
+		dup2(inputs[0].fd, STDIN_FILENO);
+		close(inputs[0].fd);
+		inputs[0].fd = STDIN_FILENO;
+		file = (char *)inputs[0].name;
+		curinput = selected = inputs;
 	}
 
-	if (mqtt_qos < 0)
-		mqtt_qos = !strcmp(mqtt_host ?: "", "localhost") ? 0 : 1;
+	if (outfile)
+		goto mqtt_done;
 	/* MQTT start */
+	mqtt_host = strdup(mqtt_host);
+	for (tok = strtok(mqtt_host, ","); tok; tok = strtok(NULL, ","))
+		broker_add(tok);
+	if (!nbrokers)
+		mylog(LOG_ERR | LOG_EXIT, "no MQTT host");
+	if (mqtt_qos < 0) {
+		/* QoS 0 when all brokers are local */
+		for (j = 0; j < nbrokers && !strcmp(brokers[j].host, "localhost"); ++j)
+			;
+		mqtt_qos = j < nbrokers;
+	}
+	if (nbrokers > 1)
+		ring_init();
+	curbroker = broker_for(topicprefix);
+	asprintf(&willtopic, "%salive", topicprefix);
 	mosquitto_lib_init();
-	sprintf(mqtt_name, "%s-%i", NAME, getpid());
-	mosq = mosquitto_new(mqtt_name, true, NULL);
-	if (!mosq)
-		mylog(LOG_ERR | LOG_EXIT, "mosquitto_new failed: %s", ESTR(errno));
+	for (b = brokers; b < brokers+nbrokers; ++b) {
+		/* a client id is unique per broker, brokers may be 1 server */
+		if (nbrokers > 1)
+			sprintf(mqtt_name, "%s-%i-%i", NAME, getpid(), (int)(b - brokers));
+		else
+			sprintf(mqtt_name, "%s-%i", NAME, getpid());
+		b->mosq = mosquitto_new(mqtt_name, true, b);
+		if (!b->mosq)
+			mylog(LOG_ERR | LOG_EXIT, "mosquitto_new failed: %s", ESTR(errno));
 
-	char *willtopic;
-	asprintf(&willtopic, "%salive", topicprefix);
-	ret = mosquitto_will_set(mosq, willtopic, 7, "crashed", mqtt_qos, 1);
-	if (ret)
-		mylog(LOG_ERR | LOG_EXIT, "mosquitto_will_set: %s", mosquitto_strerror(ret));
-	free(willtopic);
+		ret = mosquitto_will_set(b->mosq, willtopic, 7, "crashed",
+				class_qos[TC_ALIVE] >= 0 ? class_qos[TC_ALIVE] : mqtt_qos, 1);
+		if (ret)
+			mylog(LOG_ERR | LOG_EXIT, "mosquitto_will_set: %s", mosquitto_strerror(ret));
 
-	ret = mosquitto_connect(mosq, mqtt_host, mqtt_port, mqtt_keepalive);
-	if (ret)
-		mylog(LOG_ERR | LOG_EXIT, "mosquitto_connect %s:%i: %s", mqtt_host, mqtt_port, mosquitto_strerror(ret));
-	mosquitto_message_callback_set(mosq, my_mqtt_msg);
+		mosquitto_message_callback_set(b->mosq, my_mqtt_msg);
+#ifdef HAVE_MQTT5
+		if (mqtt5) {
+			ret = mosquitto_int_option(b->mosq, MOSQ_OPT_PROTOCOL_VERSION, MQTT_PROTOCOL_V5);
+			if (ret)
+				mylog(LOG_ERR | LOG_EXIT, "mosquitto_int_option: %s", mosquitto_strerror(ret));
+			mosquitto_connect_v5_callback_set(b->mosq, my_mqtt_connect_v5);
+		} else
+#endif
+		mosquitto_connect_callback_set(b->mosq, my_mqtt_connect);
+		mosquitto_disconnect_callback_set(b->mosq, my_mqtt_disconnect);
+		mosquitto_publish_callback_set(b->mosq, my_mqtt_publish);
+
+		/* don't block on a slow broker, the main loop completes the connection */
+		ret = mosquitto_connect_async(b->mosq, b->host, b->port, mqtt_keepalive);
+		if (ret) {
+			mylog(LOG_WARNING, "mosquitto_connect %s:%i: %s, retrying", b->host, b->port, mosquitto_strerror(ret));
+			b->reconnect_time = time(NULL) + 1;
+		}
+	}
 
-	asprintf(&str, "%s%s#", topicprefix, cfgprefix);
-	ret = mosquitto_subscribe(mosq, NULL, str, mqtt_qos);
-	if (ret)
-		mylog(LOG_ERR | LOG_EXIT, "mosquitto_subscribe %s: %s", str, mosquitto_strerror(ret));
-	free(str);
+	if (journal)
+		journal_open();
+
+	if (resume && !curbroker->reconnect_time) {
+		/* fetch our retained topics from our broker, until our self sync returns */
+		asprintf(&str, "%s#", topicprefix);
+		seeding = 1;
+		ret = mosquitto_subscribe(curbroker->mosq, NULL, str, mqtt_qos);
+		if (ret)
+			mylog(LOG_ERR | LOG_EXIT, "mosquitto_subscribe %s: %s", str, mosquitto_strerror(ret));
+		send_self_sync(curbroker->mosq);
+		/* like at exit, the broker gets the keepalive time */
+		time_t deadline = time(NULL) + mqtt_keepalive;
+		while (!ready) {
+			if (time(NULL) >= deadline) {
+				mylog(LOG_WARNING, "broker %s:%i: no self sync within %is, not resuming",
+						curbroker->host, curbroker->port, mqtt_keepalive);
+				break;
+			}
+			ret = mosquitto_loop(curbroker->mosq, 1000, 1);
+			if (ret) {
+				mylog(LOG_WARNING, "mosquitto_loop: %s, not resuming", mosquitto_strerror(ret));
+				mqtt_lost(curbroker, ret);
+				break;
+			}
+		}
+		ready = 0;
+		seeding = 0;
+		ret = mosquitto_unsubscribe(curbroker->mosq, NULL, str);
+		if (ret)
+			mylog(LOG_ERR | LOG_EXIT, "mosquitto_unsubscribe %s: %s", str, mosquitto_strerror(ret));
+		free(str);
+		seedsweep = time(NULL) + (deadtime + 999) / 1000;
+	}
+mqtt_done:
+
+	if (jobs) {
+		batch_run(STDIN_FILENO);
+		goto terminate;
+	}
+
+	if (shmname)
+		shm_init();
 
 	/* prepare signalfd */
 	struct signalfd_siginfo sfdi;
@@ -1151,91 +5877,289 @@ int main(int argc, char *argv[])
 	if (sigfd < 0)
 		mylog(LOG_ERR | LOG_EXIT, "signalfd failed: %s", ESTR(errno));
 
-	/* prepare poll */
-	pf[0].fd = STDIN_FILENO;
-	pf[0].events = POLL_IN;
-	pf[1].fd = mosquitto_socket(mosq);
-	pf[1].events = POLL_IN;
-	pf[2].fd = sigfd;
-	pf[2].events = POLL_IN;
+	/* prepare epoll */
+	struct epoll_event *evs;
+	int nevs, nready, k, ticktfd, statstfd = -1, predicttfd = -1;
+	struct input *in;
+
+	/* room for the always readable inputs */
+	evs = calloc(8 + ninputs, sizeof(*evs));
+	if (!evs)
+		mylog(LOG_ERR | LOG_EXIT, "calloc %u events: %s", 8 + ninputs, ESTR(errno));
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0)
+		mylog(LOG_ERR | LOG_EXIT, "epoll_create1: %s", ESTR(errno));
+	for (in = inputs, nready = 0; in < inputs+ninputs; ++in) {
+		/* the event id carries the input index */
+		if (ev_add(in->fd, EPOLLIN, EV_INPUT | (in-inputs) << 8) < 0) {
+			if (errno != EPERM)
+				mylog(LOG_ERR | LOG_EXIT, "epoll_ctl add %s: %s", in->name, ESTR(errno));
+			/* regular files can't be polled, they're always readable */
+			in->regular = 1;
+			++nready;
+		}
+		in->deadtfd = timer_new(EV_DEAD | (in-inputs) << 8);
+		/* schedule dead timer */
+		timer_set(in->deadtfd, deadtime, deadtime);
+	}
+	if (ev_add(sigfd, EPOLLIN, EV_SIGNAL) < 0)
+		mylog(LOG_ERR | LOG_EXIT, "epoll_ctl add signalfd: %s", ESTR(errno));
+	if (ninputs > 1)
+		selgrace = time(NULL) + (deadtime + 999) / 1000;
+	ticktfd = timer_new(EV_TICK);
+	/* housekeeping each second */
+	timer_set(ticktfd, 1000, 1000);
+	if (statsinterval) {
+		statstfd = timer_new(EV_STATS);
+		timer_set(statstfd, statsinterval*1000, statsinterval*1000);
+	}
+	if (predict_hz > 0) {
+		int msec = 1000 / predict_hz;
+
+		if (msec < 1)
+			msec = 1;
+		predicttfd = timer_new(EV_PREDICT);
+		timer_set(predicttfd, msec, msec);
+	}
+	if (gpsdaddr) {
+		gpsd_listen();
+		gpsdtfd = timer_new(EV_GPSD_FLUSH);
+	}
+	if (ngwaddrs)
+		gw_listen();
+	if (lowlatency)
+		lowlat_init();
 
-	static char line[1024];
-	/* schedule dead alarm */
-	alarm(deaddelay);
+	static char line[65536];
 
 	publish_topicrt(NULL, "src", 1, "%s", file ?: "-");
+	if (ngwaddrs) {
+		/* the worker is alive, regardless of its sources */
+		publish_topicrt(NULL, "alive", FL_RETAIN, "1");
+		flush_pending_topics();
+	}
+	/* log from here on without blocking */
+	logdefer = 1;
 	while (!sigterm) {
-		ret = poll(pf, 3, 1000);
-		if (ret < 0)
-			mylog(LOG_ERR | LOG_EXIT, "poll ...");
-		if (pf[0].revents) {
+		for (b = brokers; b < brokers+nbrokers; ++b)
+			mqtt_watch(b);
+		/* leave room for the input events */
+		nevs = epoll_wait(epfd, evs, 8, (nready || lowlatency) ? 0 : -1);
+		if (nevs < 0 && errno == EINTR)
+			continue;
+		if (nevs < 0)
+			mylog(LOG_ERR | LOG_EXIT, "epoll_wait: %s", ESTR(errno));
+		for (in = inputs; nready && in < inputs+ninputs; ++in) {
+			if (in->regular && !in->eof) {
+				/* fake an input event */
+				evs[nevs].events = EPOLLIN;
+				evs[nevs++].data.u32 = EV_INPUT | (in-inputs) << 8;
+			}
+		}
+		for (k = 0; k < nevs; ++k)
+		switch (evs[k].data.u32 & 0xff) {
+		case EV_INPUT:
+			in = inputs + (evs[k].data.u32 >> 8);
 			/* read input events */
-			ret = read(STDIN_FILENO, line, sizeof(line));
+			ret = read(in->fd, line, throughput ? sizeof(line) : 1024);
 			if (ret < 0 && errno == EAGAIN)
 				/* another reader snooped our data away */
-				goto gps_done;
+				break;
 			if (ret < 0)
-				mylog(LOG_ERR | LOG_EXIT, "read stdin: %s", ESTR(errno));
-			/* schedule dead alarm */
-			alarm(deaddelay);
-			if (!ret)
+				mylog(LOG_ERR | LOG_EXIT, "read %s: %s", in->name, ESTR(errno));
+			/* schedule dead timer */
+			timer_set(in->deadtfd, deadtime, deadtime);
+			if (!ret) {
+				if (ninputs == 1)
+					goto eof;
+				mylog(LOG_NOTICE, "%s: end of file", in->name);
+				in->eof = 1;
+				in->alive = 0;
+				timer_set(in->deadtfd, 0, 0);
+				if (in->regular)
+					--nready;
+				else
+					epoll_ctl(epfd, EPOLL_CTL_DEL, in->fd, NULL);
+				for (in = inputs; in < inputs+ninputs; ++in) {
+					if (!in->eof)
+						break;
+				}
+				if (in >= inputs+ninputs)
+					goto eof;
+				input_select();
 				break;
+			}
+			if (!in->alive) {
+				in->alive = 1;
+				if (!selected->alive)
+					input_select();
+			}
 			if (portalive < 1) {
 				publish_topicrt(NULL, "alive", 1, "1");
 				flush_pending_topics();
 				portalive = 1;
 			}
+			curinput = in;
+			if (lowlatency)
+				rxtime = mono_ns();
+			if (throughput)
+				mqtt_cork(1);
 			recvd_data(line, ret);
-		}
-gps_done:
-		if (pf[1].revents) {
-			/* mqtt read ... */
-			ret = mosquitto_loop_read(mosq, 1);
-			if (ret)
-				mylog(LOG_ERR | LOG_EXIT, "mosquitto_loop_read: %s", mosquitto_strerror(ret));
-		}
-		while (pf[2].revents) {
-			ret = read(sigfd, &sfdi, sizeof(sfdi));
-			if (ret < 0 && errno == EAGAIN)
-				break;
-			if (ret < 0)
-				mylog(LOG_ERR | LOG_EXIT, "read signalfd: %s", ESTR(errno));
-			switch (sfdi.ssi_signo) {
-			case SIGTERM:
-			case SIGINT:
-				sigterm = 1;
-				break;
-			case SIGALRM:
-				if (portalive != 0) {
-					publish_topicrt(NULL, "alive", 1, "0");
-					erase_topics(0);
-					flush_pending_topics();
-					portalive = 0;
+			if (throughput)
+				mqtt_cork(0);
+			rxtime = 0;
+			if (gpsddirty)
+				/* (re)schedule the end of the epoch */
+				timer_set(gpsdtfd, GPSD_FLUSH, 0);
+			break;
+		case EV_MQTT:
+			b = brokers + (evs[k].data.u32 >> 8);
+			if (evs[k].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+				ret = mosquitto_loop_read(b->mosq, 1);
+				if (ret)
+					mqtt_lost(b, ret);
+			}
+			break;
+		case EV_SIGNAL:
+			for (;;) {
+				ret = read(sigfd, &sfdi, sizeof(sfdi));
+				if (ret < 0 && errno == EAGAIN)
+					break;
+				if (ret < 0)
+					mylog(LOG_ERR | LOG_EXIT, "read signalfd: %s", ESTR(errno));
+				switch (sfdi.ssi_signo) {
+				case SIGTERM:
+				case SIGINT:
+					sigterm = 1;
+					break;
+				case SIGUSR1:
+					log_stats();
+					break;
 				}
-				/* schedule next */
-				alarm(deaddelay);
+			}
+			break;
+		case EV_DEAD:
+			in = inputs + (evs[k].data.u32 >> 8);
+			timer_ack(in->deadtfd);
+			if (in->alive) {
+				in->alive = 0;
+				if (ninputs > 1)
+					mylog(LOG_WARNING, "%s: dead", in->name);
+				input_select();
+			}
+			for (in = inputs; in < inputs+ninputs; ++in) {
+				if (in->alive)
+					break;
+			}
+			if (in < inputs+ninputs)
+				/* another input is alive */
 				break;
+			if (portalive != 0) {
+				publish_topicrt(NULL, "alive", 1, "0");
+				erase_topics(0);
+				flush_pending_topics();
+				portalive = 0;
+			}
+			break;
+		case EV_TICK:
+			timer_ack(ticktfd);
+			log_tick();
+			if (seedsweep && time(NULL) >= seedsweep) {
+				sweep_seeded();
+				seedsweep = 0;
 			}
+			if (selgrace && time(NULL) >= selgrace) {
+				selgrace = 0;
+				input_select();
+			}
+			if (ngwaddrs)
+				gw_sweep();
+			for (b = brokers; b < brokers+nbrokers; ++b) {
+				ret = mosquitto_loop_misc(b->mosq);
+				if (ret && ret != MOSQ_ERR_NO_CONN)
+					mqtt_lost(b, ret);
+				mqtt_reconnect(b);
+			}
+			journal_tick();
+			break;
+		case EV_STATS:
+			timer_ack(statstfd);
+			log_stats();
+			break;
+		case EV_PREDICT:
+			timer_ack(predicttfd);
+			predict_tick();
+			break;
+		case EV_GPSD_LISTEN:
+			gpsd_accept();
+			break;
+		case EV_GPSD_FLUSH:
+			timer_ack(gpsdtfd);
+			gpsd_flush();
+			break;
+		case EV_GW_UDP:
+			gw_udp_recv(gwfds[evs[k].data.u32 >> 8]);
+			break;
+		case EV_GW_LISTEN:
+			gw_accept(gwfds[evs[k].data.u32 >> 8]);
+			break;
+		case EV_GW_PEER:
+			j = evs[k].data.u32 >> 8;
+			if (gwpeers[j])
+				gw_peer_recv(j);
+			break;
+		case EV_GPSD:
+			j = evs[k].data.u32 >> 8;
+			if (!gclients[j])
+				/* closed during this iteration */
+				break;
+			if (evs[k].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+				gpsd_recv(j);
+			else if (evs[k].events & EPOLLOUT)
+				gpsd_send(j);
+			break;
 		}
 		/* mosquitto things to do each iteration */
-		ret = mosquitto_loop_misc(mosq);
-		if (ret)
-			mylog(LOG_ERR | LOG_EXIT, "mosquitto_loop_misc: %s", mosquitto_strerror(ret));
-		if (mosquitto_want_write(mosq)) {
-			ret = mosquitto_loop_write(mosq, 1);
-			if (ret)
-				mylog(LOG_ERR | LOG_EXIT, "mosquitto_loop_write: %s", mosquitto_strerror(ret));
+		for (b = brokers; b < brokers+nbrokers; ++b) {
+			if (mosquitto_want_write(b->mosq)) {
+				ret = mosquitto_loop_write(b->mosq, 1);
+				if (ret)
+					mqtt_lost(b, ret);
+			}
+			outq_flush(b);
 		}
+		journal_drain();
+		log_drain(0);
 	}
+eof:
+	logdefer = 0;
+	log_drain(1);
 
+	/* the last epoch */
+	gpsd_flush();
+	gw_exit();
 	erase_topics(1);
 	clear_gsvs();
-	/* terminate */
-	send_self_sync(mosq);
-	while (!ready) {
-		ret = mosquitto_loop(mosq, 10, 1);
-		if (ret)
-			mylog(LOG_ERR | LOG_EXIT, "mosquitto_loop: %s", mosquitto_strerror(ret));
+terminate:
+	if (!nbrokers) {
+		fflush(outfile);
+		return 0;
+	}
+	/* terminate, flush our queues within the keepalive time */
+	time_t deadline = time(NULL) + mqtt_keepalive;
+
+	while (outq_pending() && time(NULL) < deadline)
+		mqtt_service_all(10);
+	for (b = brokers; b < brokers+nbrokers; ++b) {
+		if (b->qhead || !b->connected) {
+			mylog(LOG_WARNING, "broker %s:%i unreachable, %lu messages lost", b->host, b->port, b->qlen);
+			continue;
+		}
+		ready = 0;
+		send_self_sync(b->mosq);
+		while (!ready && b->connected && time(NULL) < deadline)
+			mqtt_service(b, 10);
 	}
 
 	return 0;
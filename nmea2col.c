@@ -0,0 +1,542 @@
+/*
+ * Copyright 2018 Kurt Van Dijck <dev.kurt@vandijck-laurijssen.be>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <getopt.h>
+#include <syslog.h>
+#include <sys/uio.h>
+
+#include "lib/nmea.h"
+
+#define NAME "nmea2col"
+#ifndef VERSION
+#define VERSION "<undefined version>"
+#endif
+
+/* generic error logging */
+#define LOG_EXIT	0x4000000
+
+/* safeguard our LOG_EXIT extension */
+#if (LOG_EXIT & (LOG_FACMASK | LOG_PRIMASK))
+#error LOG_EXIT conflict
+#endif
+
+static int loglevel = LOG_WARNING;
+
+void mylog(int level, const char *fmt, ...)
+{
+	va_list va;
+	char *msg = NULL;
+
+	if ((level & LOG_PRIMASK) <= loglevel) {
+		va_start(va, fmt);
+		vasprintf(&msg, fmt, va);
+		va_end(va);
+
+		struct iovec vec[] = {
+			{ .iov_base = NAME, .iov_len = strlen(NAME), },
+			{ .iov_base = ": ", .iov_len = 2, },
+			{ .iov_base = msg, .iov_len = strlen(msg), },
+			{ .iov_base = "\n", .iov_len = 1, },
+		};
+		writev(STDERR_FILENO, vec, sizeof(vec)/sizeof(vec[0]));
+		free(msg);
+	}
+	if (level & LOG_EXIT)
+		exit(1);
+}
+
+#define ESTR(num)	strerror(num)
+
+/* program options */
+static const char help_msg[] =
+	NAME ": Convert nmea0183 logs to columnar data\n"
+	"usage:	" NAME " [OPTIONS ...] [FILE]\n"
+	"\n"
+	"Options\n"
+	" -V, --version		Show version\n"
+	" -v, --verbose		Be more verbose\n"
+	" -o, --output=FILE	Write epoch table to FILE (default stdout)\n"
+	" -s, --sats=FILE	Write satellite table to FILE\n"
+	" -b, --binary=DIR	Write binary columns in DIR, in native byte order\n"
+	"			DIR/epoch.COLUMN.TYPE and DIR/sat.COLUMN.TYPE\n"
+	"			TYPE is f64, i32 or c2\n"
+	" -n, --nmea=GGA[,GSV...]	Decode only these sentences\n"
+	"			Possible: GGA, GNS, GSA, GSV, VTG, ZDA\n"
+	"			Default: all\n"
+	" -f, --from=TIME	Skip epochs before TIME\n"
+	" -u, --until=TIME	Skip epochs from TIME on\n"
+	"			TIME is seconds since 1970 or YYYY-MM-DDTHH:MM:SS (UTC)\n"
+	"\n"
+	"Output\n"
+	" Each epoch yields 1 row. Epochs are delimited by a change in the UTC time\n"
+	" or by a repeated sentence.\n"
+	" 'time' is seconds since 1970 as soon as a ZDA provided the date,\n"
+	" and seconds since midnight before that\n"
+	;
+
+#ifdef _GNU_SOURCE
+static struct option long_opts[] = {
+	{ "help", no_argument, NULL, '?', },
+	{ "version", no_argument, NULL, 'V', },
+	{ "verbose", no_argument, NULL, 'v', },
+
+	{ "output", required_argument, NULL, 'o', },
+	{ "sats", required_argument, NULL, 's', },
+	{ "binary", required_argument, NULL, 'b', },
+	{ "nmea", required_argument, NULL, 'n', },
+	{ "from", required_argument, NULL, 'f', },
+	{ "until", required_argument, NULL, 'u', },
+
+	{ },
+};
+#else
+#define getopt_long(argc, argv, optstring, longopts, longindex) \
+	getopt((argc), (argv), (optstring))
+#endif
+static const char optstring[] = "Vv?o:s:b:n:f:u:";
+
+/* decoded sentence set */
+#define NM_GGA	(1 << 0)
+#define NM_GNS	(1 << 1)
+#define NM_GSA	(1 << 2)
+#define NM_GSV	(1 << 3)
+#define NM_VTG	(1 << 4)
+#define NM_ZDA	(1 << 5)
+static const char *const nmnames[] = {
+	"GGA", "GNS", "GSA", "GSV", "VTG", "ZDA", NULL,
+};
+static int nmea_use = ~0;
+
+static double tfrom = -INFINITY, tuntil = INFINITY;
+
+/* tables */
+enum coltype {
+	F64,
+	I32,
+	C2,
+};
+static const char *const coltypes[] = {
+	[F64] = "f64",
+	[I32] = "i32",
+	[C2] = "c2",
+};
+
+struct col {
+	const char *name;
+	int type;
+	size_t off;
+	FILE *fp;
+};
+
+struct table {
+	const char *name;
+	struct col *cols;
+	FILE *fp;
+	int binary;
+};
+
+struct epoch {
+	double time;
+	double lat, lon;
+	double alt, geoid;
+	int quality;
+	int satuse;
+	double hdop, pdop, vdop;
+	int mode;
+	double speed, heading;
+	/* NM_xxx bits of decoded sentences */
+	int seen;
+};
+
+struct satrow {
+	double time;
+	char talker[2];
+	int prn;
+	int elv, azm, snr;
+};
+
+#define COL(str, type, st, member) { str, type, offsetof(st, member), }
+static struct col epochcols[] = {
+	COL("time", F64, struct epoch, time),
+	COL("lat", F64, struct epoch, lat),
+	COL("lon", F64, struct epoch, lon),
+	COL("alt", F64, struct epoch, alt),
+	COL("geoid", F64, struct epoch, geoid),
+	COL("quality", I32, struct epoch, quality),
+	COL("satuse", I32, struct epoch, satuse),
+	COL("hdop", F64, struct epoch, hdop),
+	COL("pdop", F64, struct epoch, pdop),
+	COL("vdop", F64, struct epoch, vdop),
+	COL("mode", I32, struct epoch, mode),
+	COL("speed", F64, struct epoch, speed),
+	COL("heading", F64, struct epoch, heading),
+	{ },
+};
+
+static struct col satcols[] = {
+	COL("time", F64, struct satrow, time),
+	COL("talker", C2, struct satrow, talker),
+	COL("prn", I32, struct satrow, prn),
+	COL("elv", I32, struct satrow, elv),
+	COL("azm", I32, struct satrow, azm),
+	COL("snr", I32, struct satrow, snr),
+	{ },
+};
+
+static struct table epochtbl = { "epoch", epochcols, };
+static struct table sattbl = { "sat", satcols, };
+
+static void open_table(struct table *tbl, const char *file, const char *dir)
+{
+	struct col *col;
+	char *path;
+
+	if (dir) {
+		tbl->binary = 1;
+		for (col = tbl->cols; col->name; ++col) {
+			asprintf(&path, "%s/%s.%s.%s", dir, tbl->name, col->name, coltypes[col->type]);
+			col->fp = fopen(path, "w");
+			if (!col->fp)
+				mylog(LOG_ERR | LOG_EXIT, "fopen %s: %s", path, ESTR(errno));
+			free(path);
+		}
+		return;
+	}
+	if (!file)
+		return;
+	tbl->fp = strcmp(file, "-") ? fopen(file, "w") : stdout;
+	if (!tbl->fp)
+		mylog(LOG_ERR | LOG_EXIT, "fopen %s: %s", file, ESTR(errno));
+	/* csv header */
+	for (col = tbl->cols; col->name; ++col)
+		fprintf(tbl->fp, "%s%s", (col == tbl->cols) ? "" : ",", col->name);
+	fputc('\n', tbl->fp);
+}
+
+static void close_table(struct table *tbl)
+{
+	struct col *col;
+
+	for (col = tbl->cols; col->name; ++col) {
+		if (col->fp)
+			fclose(col->fp);
+	}
+	if (tbl->fp)
+		fclose(tbl->fp);
+}
+
+static void emit_row(struct table *tbl, const void *row)
+{
+	struct col *col;
+	const void *val;
+	double dval;
+	int ival;
+
+	for (col = tbl->cols; col->name; ++col) {
+		val = (const char *)row + col->off;
+		if (tbl->binary) {
+			fwrite_unlocked(val, (col->type == I32) ? 4 : (col->type == C2) ? 2 : 8, 1, col->fp);
+			continue;
+		}
+		if (!tbl->fp)
+			return;
+		if (col != tbl->cols)
+			putc_unlocked(',', tbl->fp);
+		switch (col->type) {
+		case F64:
+			memcpy(&dval, val, sizeof(dval));
+			if (!isnan(dval))
+				fprintf(tbl->fp, "%.12g", dval);
+			break;
+		case I32:
+			memcpy(&ival, val, sizeof(ival));
+			if (ival >= 0)
+				fprintf(tbl->fp, "%i", ival);
+			break;
+		case C2:
+			fprintf(tbl->fp, "%.2s", (const char *)val);
+			break;
+		}
+	}
+	if (tbl->fp)
+		putc_unlocked('\n', tbl->fp);
+}
+
+/* epoch state */
+static struct epoch cur;
+static double daybase = NAN;
+static double lasttod = NAN;
+static int ignored_epochs;
+
+static void reset_epoch(void)
+{
+	cur = (struct epoch){
+		.time = NAN,
+		.lat = NAN, .lon = NAN,
+		.alt = NAN, .geoid = NAN,
+		.quality = -1,
+		.satuse = -1,
+		.hdop = NAN, .pdop = NAN, .vdop = NAN,
+		.mode = -1,
+		.speed = NAN, .heading = NAN,
+	};
+}
+
+static void flush_epoch(void)
+{
+	if (!cur.seen)
+		return;
+	if (!isnan(cur.time) && cur.time >= tfrom && cur.time < tuntil)
+		emit_row(&epochtbl, &cur);
+	else
+		++ignored_epochs;
+	reset_epoch();
+}
+
+static double tod_to_time(double tod)
+{
+	if (isnan(tod))
+		return NAN;
+	if (!isnan(daybase) && !isnan(lasttod) && tod < lasttod - 43200)
+		/* midnight passed */
+		daybase += 86400;
+	lasttod = tod;
+	return isnan(daybase) ? tod : daybase + tod;
+}
+
+/* start a sentence of type <nm>, and flush the epoch when needed */
+static void epoch_sentence(int nm, double tod)
+{
+	double t = tod_to_time(tod);
+
+	if (!isnan(t) && !isnan(cur.time) && t != cur.time)
+		flush_epoch();
+	else if ((cur.seen & nm) && nm != NM_GSV)
+		/* repeated sentence without time: next epoch */
+		flush_epoch();
+	if (!isnan(t))
+		cur.time = t;
+	cur.seen |= nm;
+}
+
+static void recvd_line(char *line)
+{
+	const char *tok;
+	int ret, j;
+
+	if (!*line)
+		return;
+	ret = nmea_check_sentence(line);
+	if (ret < 0) {
+		mylog(LOG_INFO, "%s '%.10s'", nmea_strerror(ret), line);
+		return;
+	}
+	tok = nmea_tok(line);
+	if (!tok || strlen(tok) <= 2)
+		return;
+
+	if (!strcmp(tok+2, "GGA") || !strcmp(tok+2, "GNS")) {
+		struct nmea_gga gga;
+
+		if (!(nmea_use & (tok[4] == 'A' ? NM_GGA : NM_GNS)))
+			return;
+		nmea_decode_gga_gns(tok, &gga);
+		epoch_sentence(NM_GGA, gga.tod);
+		cur.lat = gga.lat;
+		cur.lon = gga.lon;
+		cur.alt = gga.alt;
+		cur.geoid = gga.geoid;
+		if (gga.quality >= 0)
+			cur.quality = gga.quality;
+		cur.satuse = gga.satuse;
+		if (isnan(cur.hdop))
+			cur.hdop = gga.hdop;
+
+	} else if (!strcmp(tok+2, "GSA")) {
+		struct nmea_gsa gsa;
+
+		if (!(nmea_use & NM_GSA))
+			return;
+		nmea_decode_gsa(&gsa);
+		if (gsa.sysid != 1)
+			/* only use first packet */
+			return;
+		epoch_sentence(NM_GSA, NAN);
+		cur.mode = gsa.mode;
+		cur.pdop = gsa.pdop;
+		cur.hdop = gsa.hdop;
+		cur.vdop = gsa.vdop;
+
+	} else if (!strcmp(tok+2, "GSV")) {
+		struct nmea_gsv gsv;
+		struct satrow sat;
+
+		if (!(nmea_use & NM_GSV))
+			return;
+		nmea_decode_gsv(&gsv);
+		epoch_sentence(NM_GSV, NAN);
+		if (isnan(cur.time) || cur.time < tfrom || cur.time >= tuntil)
+			return;
+		sat.time = cur.time;
+		sat.talker[0] = tolower(tok[0]);
+		sat.talker[1] = tolower(tok[1]);
+		for (j = 0; j < gsv.nsv; ++j) {
+			sat.prn = gsv.sv[j].prn;
+			sat.elv = gsv.sv[j].elv;
+			sat.azm = gsv.sv[j].azm;
+			sat.snr = gsv.sv[j].snr;
+			emit_row(&sattbl, &sat);
+		}
+
+	} else if (!strcmp(tok+2, "VTG")) {
+		struct nmea_vtg vtg;
+
+		if (!(nmea_use & NM_VTG))
+			return;
+		nmea_decode_vtg(&vtg);
+		epoch_sentence(NM_VTG, NAN);
+		cur.speed = vtg.speed;
+		cur.heading = vtg.heading;
+
+	} else if (!strcmp(tok+2, "ZDA")) {
+		struct nmea_zda zda;
+		struct tm tm = {};
+
+		if (!(nmea_use & NM_ZDA))
+			return;
+		nmea_decode_zda(&zda);
+		if (zda.year && zda.mon && zda.mday) {
+			tm.tm_mday = zda.mday;
+			tm.tm_mon = zda.mon - 1;
+			tm.tm_year = zda.year - 1900;
+			if (isnan(daybase) && !isnan(cur.time))
+				/* first date, this epoch is still in seconds since midnight */
+				cur.time += timegm(&tm);
+			daybase = timegm(&tm);
+			/* don't detect midnight on this one */
+			lasttod = NAN;
+		}
+		epoch_sentence(NM_ZDA, zda.tod);
+	}
+}
+
+static double parse_time(const char *str)
+{
+	struct tm tm = {};
+	char *endp;
+	double val;
+
+	val = strtod(str, &endp);
+	if (!*endp)
+		return val;
+	endp = strptime(str, "%Y-%m-%dT%H:%M:%S", &tm);
+	if (!endp || *endp)
+		mylog(LOG_ERR | LOG_EXIT, "bad time '%s'", str);
+	return timegm(&tm);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, j;
+	char *tok;
+	const char *epochfile = "-", *satfile = NULL, *bindir = NULL;
+	FILE *fp = stdin;
+	char *line = NULL;
+	size_t linesize = 0;
+	ssize_t ret;
+
+	/* argument parsing */
+	while ((opt = getopt_long(argc, argv, optstring, long_opts, NULL)) >= 0)
+	switch (opt) {
+	case 'V':
+		fprintf(stderr, "%s %s\nCompiled on %s %s\n",
+				NAME, VERSION, __DATE__, __TIME__);
+		exit(0);
+	case 'v':
+		++loglevel;
+		break;
+	case 'o':
+		epochfile = optarg;
+		break;
+	case 's':
+		satfile = optarg;
+		break;
+	case 'b':
+		bindir = optarg;
+		break;
+	case 'n':
+		nmea_use = 0;
+		for (tok = strtok(optarg, ","); tok; tok = strtok(NULL, ",")) {
+			for (j = 0; nmnames[j]; ++j) {
+				if (!strcasecmp(nmnames[j], tok))
+					break;
+			}
+			if (!nmnames[j])
+				mylog(LOG_ERR | LOG_EXIT, "unknown sentence '%s'", tok);
+			nmea_use |= 1 << j;
+		}
+		break;
+	case 'f':
+		tfrom = parse_time(optarg);
+		break;
+	case 'u':
+		tuntil = parse_time(optarg);
+		break;
+
+	default:
+		fprintf(stderr, "unknown option '%c'", opt);
+	case '?':
+		fputs(help_msg, stderr);
+		exit(1);
+		break;
+	}
+
+	if (optind < argc) {
+		fp = fopen(argv[optind], "r");
+		if (!fp)
+			mylog(LOG_ERR | LOG_EXIT, "fopen %s: %s", argv[optind], ESTR(errno));
+	}
+	open_table(&epochtbl, epochfile, bindir);
+	open_table(&sattbl, satfile, (satfile || !bindir) ? NULL : bindir);
+
+	reset_epoch();
+	while ((ret = getline(&line, &linesize, fp)) > 0) {
+		/* cut \r\n */
+		while (ret && (line[ret-1] == '\r' || line[ret-1] == '\n'))
+			line[--ret] = 0;
+		recvd_line(line);
+	}
+	flush_epoch();
+	if (ignored_epochs)
+		mylog(LOG_INFO, "%i epochs skipped", ignored_epochs);
+
+	close_table(&epochtbl);
+	close_table(&sattbl);
+	free(line);
+	return 0;
+}